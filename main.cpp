@@ -1,72 +1,4807 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <unordered_set>
+#include <unordered_map>
+#include <map>
 #include <algorithm>
 #include <chrono>
 #include <iomanip>
 #include <numeric>
+#include <cmath>
+#include <limits>
+#include <iterator>
+#include <cstdint>
+#include <stdexcept>
+#include <cstring>
+#include <type_traits>
+#include <thread>
+#include <functional>
+#include <istream>
+#include <cerrno>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <fstream>
+#include <array>
+#include <utility>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <deque>
+#include <cstdio>
+#include <filesystem>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#define ROLLING_HASHSET_HAS_PERF_EVENT 1
+#endif
+
+#if defined(__linux__) && __has_include(<linux/mempolicy.h>)
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#define ROLLING_HASHSET_HAS_NUMA 1
+#endif
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#define ROLLING_HASHSET_HAS_SPAN 1
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Run f(worker) for every worker in [0, workers); the last worker runs on the calling thread
+template<typename F>
+void parallelFor(size_t workers, F&& f) {
+    std::vector<std::thread> threads;
+    threads.reserve(workers > 0 ? workers - 1 : 0);
+    for (size_t w = 0; w + 1 < workers; w++) {
+        threads.emplace_back([&f, w] { f(w); });
+    }
+    if (workers > 0) f(workers - 1);
+    for (auto& t : threads) t.join();
+}
+
+// Non-owning pattern list used by the zero-copy search APIs
+using PatternViews = std::vector<std::string_view>;
+
+inline PatternViews toPatternViews(const std::vector<std::string>& patterns) {
+    return PatternViews(patterns.begin(), patterns.end());
+}
+
+// patterns[i] for every i in indices, e.g. to turn an *Indices result back into strings or views
+template<typename Pattern>
+std::vector<Pattern> selectPatterns(const std::vector<Pattern>& patterns, const std::vector<size_t>& indices) {
+    std::vector<Pattern> result;
+    result.reserve(indices.size());
+    for (size_t i : indices) result.push_back(patterns[i]);
+    return result;
+}
+
+// Byte normalization applied while hashing and comparing, e.g. ASCII case folding
+// Two strings match under a map when their mapped bytes are equal. The searches apply
+// the map per byte inside their hash and compare loops, so no normalized copy of the
+// text or the patterns is ever made. The default map is the identity.
+class ByteMap {
+public:
+    ByteMap() {
+        for (unsigned c = 0; c < 256; c++) table[c] = static_cast<unsigned char>(c);
+    }
+
+    explicit ByteMap(const std::array<unsigned char, 256>& table) : table(table) {
+        for (unsigned c = 0; c < 256; c++) identity &= table[c] == c;
+    }
+
+    // 'A'-'Z' map to 'a'-'z'; every other byte maps to itself
+    static ByteMap asciiCaseFold() {
+        std::array<unsigned char, 256> table{};
+        for (unsigned c = 0; c < 256; c++) {
+            table[c] = static_cast<unsigned char>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+        }
+        return ByteMap(table);
+    }
+
+    unsigned char operator()(char c) const { return table[static_cast<unsigned char>(c)]; }
+    bool isIdentity() const { return identity; }
+    const std::array<unsigned char, 256>& getTable() const { return table; }
+
+    bool operator==(const ByteMap& other) const { return table == other.table; }
+    bool operator!=(const ByteMap& other) const { return table != other.table; }
+
+    // a[0, n) and b[0, n) are equal after mapping
+    bool equal(const char* a, const char* b, size_t n) const {
+        if (identity) return std::memcmp(a, b, n) == 0;
+        for (size_t i = 0; i < n; i++) {
+            if ((*this)(a[i]) != (*this)(b[i])) return false;
+        }
+        return true;
+    }
+
+    // First offset of needle in text after mapping both, or npos; see simd_find::find for
+    // the vectorized version
+    size_t find(std::string_view text, std::string_view needle) const {
+        if (identity) return text.find(needle);
+        if (needle.size() > text.size()) return std::string_view::npos;
+        if (needle.empty()) return 0;
+        const unsigned char first = (*this)(needle[0]);
+        for (size_t i = 0; i + needle.size() <= text.size(); i++) {
+            if ((*this)(text[i]) == first && equal(text.data() + i + 1, needle.data() + 1, needle.size() - 1)) {
+                return i;
+            }
+        }
+        return std::string_view::npos;
+    }
+
+private:
+    std::array<unsigned char, 256> table;
+    bool identity = true;
+};
+
+// Substring search with a SIMD first/last byte filter
+// For a needle of length k, the kernels compare needle[0] against text[i..i+W) and
+// needle[k-1] against text[i+k-1..i+k-1+W) in one step each, AND the two masks, and run
+// a full memcmp only on candidate positions. AVX2 (32 lanes) is picked at runtime when
+// the CPU supports it, otherwise SSE2 or NEON (16 lanes), otherwise std::string_view::find.
+// Under a ByteMap the first/last byte tests become byte class tests: the raw bytes that map
+// to the same value as the needle byte, as up to two ranges checked with a subtract and an
+// unsigned min. Classes that need more ranges fall back to ByteMap::find.
+namespace simd_find {
+
+using Kernel = size_t (*)(const char* text, size_t n, const char* needle, size_t k);
+
+inline size_t scalarFind(const char* text, size_t n, const char* needle, size_t k) {
+    return std::string_view(text, n).find(std::string_view(needle, k));
+}
+
+// Resolve the candidates in mask for the block at text + i; returns npos if none matched
+inline size_t resolveCandidates(uint32_t mask, const char* text, size_t i, const char* needle, size_t k) {
+    while (mask) {
+        const unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+        if (std::memcmp(text + i + bit + 1, needle + 1, k - 2) == 0) return i + bit;
+        mask &= mask - 1;
+    }
+    return std::string_view::npos;
+}
+
+// Raw bytes that map to the same value as a needle byte: [lo[r], lo[r] + span[r]] for r < 2
+struct ByteClass {
+    unsigned char lo[2];
+    unsigned char span[2];
+};
+
+// False if the class needs more than two ranges
+inline bool byteClassOf(const ByteMap& map, char c, ByteClass& out) {
+    const unsigned char target = map(c);
+    size_t ranges = 0;
+    for (unsigned b = 0; b < 256;) {
+        if (map(static_cast<char>(b)) != target) {
+            b++;
+            continue;
+        }
+        unsigned end = b;
+        while (end + 1 < 256 && map(static_cast<char>(end + 1)) == target) end++;
+        if (ranges == 2) return false;
+        out.lo[ranges] = static_cast<unsigned char>(b);
+        out.span[ranges] = static_cast<unsigned char>(end - b);
+        ranges++;
+        b = end + 1;
+    }
+    if (ranges == 1) {
+        out.lo[1] = out.lo[0];
+        out.span[1] = out.span[0];
+    }
+    return true;
+}
+
+using MappedKernel = size_t (*)(const char* text, size_t n, const char* needle, size_t k,
+                                const ByteClass& first, const ByteClass& last, const ByteMap& map);
+
+inline size_t resolveMappedCandidates(uint32_t mask, const char* text, size_t i, const char* needle, size_t k,
+                                      const ByteMap& map) {
+    while (mask) {
+        const unsigned bit = static_cast<unsigned>(__builtin_ctz(mask));
+        if (map.equal(text + i + bit + 1, needle + 1, k - 2)) return i + bit;
+        mask &= mask - 1;
+    }
+    return std::string_view::npos;
+}
+
+inline size_t scalarMappedTail(const char* text, size_t n, size_t i, const char* needle, size_t k,
+                               const ByteMap& map) {
+    const size_t rest = map.find(std::string_view(text + i, n - i), std::string_view(needle, k));
+    return rest == std::string_view::npos ? rest : i + rest;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+inline size_t avx2Find(const char* text, size_t n, const char* needle, size_t k) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 32 <= n; i += 32) {
+        const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i + k - 1));
+        const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+        const size_t found = resolveCandidates(mask, text, i, needle, k);
+        if (found != std::string_view::npos) return found;
+    }
+    const size_t rest = scalarFind(text + i, n - i, needle, k);
+    return rest == std::string_view::npos ? rest : i + rest;
+}
+
+__attribute__((target("avx2")))
+inline __m256i avx2InClass(__m256i block, __m256i lo0, __m256i span0, __m256i lo1, __m256i span1) {
+    const __m256i x0 = _mm256_sub_epi8(block, lo0);
+    const __m256i x1 = _mm256_sub_epi8(block, lo1);
+    return _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(x0, span0), x0),
+                           _mm256_cmpeq_epi8(_mm256_min_epu8(x1, span1), x1));
+}
+
+__attribute__((target("avx2")))
+inline size_t avx2FindMapped(const char* text, size_t n, const char* needle, size_t k,
+                             const ByteClass& first, const ByteClass& last, const ByteMap& map) {
+    const __m256i first_lo0 = _mm256_set1_epi8(static_cast<char>(first.lo[0]));
+    const __m256i first_span0 = _mm256_set1_epi8(static_cast<char>(first.span[0]));
+    const __m256i first_lo1 = _mm256_set1_epi8(static_cast<char>(first.lo[1]));
+    const __m256i first_span1 = _mm256_set1_epi8(static_cast<char>(first.span[1]));
+    const __m256i last_lo0 = _mm256_set1_epi8(static_cast<char>(last.lo[0]));
+    const __m256i last_span0 = _mm256_set1_epi8(static_cast<char>(last.span[0]));
+    const __m256i last_lo1 = _mm256_set1_epi8(static_cast<char>(last.lo[1]));
+    const __m256i last_span1 = _mm256_set1_epi8(static_cast<char>(last.span[1]));
+    size_t i = 0;
+    for (; i + k - 1 + 32 <= n; i += 32) {
+        const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i + k - 1));
+        const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(
+            avx2InClass(block_first, first_lo0, first_span0, first_lo1, first_span1),
+            avx2InClass(block_last, last_lo0, last_span0, last_lo1, last_span1))));
+        const size_t found = resolveMappedCandidates(mask, text, i, needle, k, map);
+        if (found != std::string_view::npos) return found;
+    }
+    return scalarMappedTail(text, n, i, needle, k, map);
+}
+#endif
+
+#if defined(__SSE2__)
+inline size_t sse2Find(const char* text, size_t n, const char* needle, size_t k) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + k - 1));
+        const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+        const size_t found = resolveCandidates(mask, text, i, needle, k);
+        if (found != std::string_view::npos) return found;
+    }
+    const size_t rest = scalarFind(text + i, n - i, needle, k);
+    return rest == std::string_view::npos ? rest : i + rest;
+}
+
+inline __m128i sse2InClass(__m128i block, __m128i lo0, __m128i span0, __m128i lo1, __m128i span1) {
+    const __m128i x0 = _mm_sub_epi8(block, lo0);
+    const __m128i x1 = _mm_sub_epi8(block, lo1);
+    return _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(x0, span0), x0),
+                        _mm_cmpeq_epi8(_mm_min_epu8(x1, span1), x1));
+}
+
+inline size_t sse2FindMapped(const char* text, size_t n, const char* needle, size_t k,
+                             const ByteClass& first, const ByteClass& last, const ByteMap& map) {
+    const __m128i first_lo0 = _mm_set1_epi8(static_cast<char>(first.lo[0]));
+    const __m128i first_span0 = _mm_set1_epi8(static_cast<char>(first.span[0]));
+    const __m128i first_lo1 = _mm_set1_epi8(static_cast<char>(first.lo[1]));
+    const __m128i first_span1 = _mm_set1_epi8(static_cast<char>(first.span[1]));
+    const __m128i last_lo0 = _mm_set1_epi8(static_cast<char>(last.lo[0]));
+    const __m128i last_span0 = _mm_set1_epi8(static_cast<char>(last.span[0]));
+    const __m128i last_lo1 = _mm_set1_epi8(static_cast<char>(last.lo[1]));
+    const __m128i last_span1 = _mm_set1_epi8(static_cast<char>(last.span[1]));
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + k - 1));
+        const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(
+            sse2InClass(block_first, first_lo0, first_span0, first_lo1, first_span1),
+            sse2InClass(block_last, last_lo0, last_span0, last_lo1, last_span1))));
+        const size_t found = resolveMappedCandidates(mask, text, i, needle, k, map);
+        if (found != std::string_view::npos) return found;
+    }
+    return scalarMappedTail(text, n, i, needle, k, map);
+}
+#endif
+
+#if defined(__ARM_NEON)
+inline size_t neonFind(const char* text, size_t n, const char* needle, size_t k) {
+    const uint8x16_t first = vdupq_n_u8(static_cast<uint8_t>(needle[0]));
+    const uint8x16_t last = vdupq_n_u8(static_cast<uint8_t>(needle[k - 1]));
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        const uint8x16_t block_first = vld1q_u8(reinterpret_cast<const uint8_t*>(text + i));
+        const uint8x16_t block_last = vld1q_u8(reinterpret_cast<const uint8_t*>(text + i + k - 1));
+        const uint8x16_t eq = vandq_u8(vceqq_u8(first, block_first), vceqq_u8(last, block_last));
+        // Narrow each 0x00/0xff byte lane to 4 bits, giving a 64-bit mask with 4 bits per lane
+        uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        while (nibbles) {
+            const unsigned bit = static_cast<unsigned>(__builtin_ctzll(nibbles)) / 4;
+            if (std::memcmp(text + i + bit + 1, needle + 1, k - 2) == 0) return i + bit;
+            nibbles &= ~(0xfULL << (bit * 4));
+        }
+    }
+    const size_t rest = scalarFind(text + i, n - i, needle, k);
+    return rest == std::string_view::npos ? rest : i + rest;
+}
+
+inline uint8x16_t neonInClass(uint8x16_t block, const ByteClass& c) {
+    const uint8x16_t x0 = vsubq_u8(block, vdupq_n_u8(c.lo[0]));
+    const uint8x16_t x1 = vsubq_u8(block, vdupq_n_u8(c.lo[1]));
+    return vorrq_u8(vcleq_u8(x0, vdupq_n_u8(c.span[0])), vcleq_u8(x1, vdupq_n_u8(c.span[1])));
+}
+
+inline size_t neonFindMapped(const char* text, size_t n, const char* needle, size_t k,
+                             const ByteClass& first, const ByteClass& last, const ByteMap& map) {
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16) {
+        const uint8x16_t block_first = vld1q_u8(reinterpret_cast<const uint8_t*>(text + i));
+        const uint8x16_t block_last = vld1q_u8(reinterpret_cast<const uint8_t*>(text + i + k - 1));
+        const uint8x16_t eq = vandq_u8(neonInClass(block_first, first), neonInClass(block_last, last));
+        uint64_t nibbles = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+        while (nibbles) {
+            const unsigned bit = static_cast<unsigned>(__builtin_ctzll(nibbles)) / 4;
+            if (map.equal(text + i + bit + 1, needle + 1, k - 2)) return i + bit;
+            nibbles &= ~(0xfULL << (bit * 4));
+        }
+    }
+    return scalarMappedTail(text, n, i, needle, k, map);
+}
+#endif
+
+inline size_t scalarFindMapped(const char* text, size_t n, const char* needle, size_t k,
+                               const ByteClass&, const ByteClass&, const ByteMap& map) {
+    return scalarMappedTail(text, n, 0, needle, k, map);
+}
+
+struct Selected {
+    Kernel kernel;
+    MappedKernel mapped;
+    const char* name;
+};
+
+inline Selected select() {
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) return {avx2Find, avx2FindMapped, "avx2"};
+#endif
+#if defined(__SSE2__)
+    return {sse2Find, sse2FindMapped, "sse2"};
+#elif defined(__ARM_NEON)
+    return {neonFind, neonFindMapped, "neon"};
+#else
+    return {scalarFind, scalarFindMapped, "scalar"};
+#endif
+}
+
+inline const Selected& selected() {
+    static const Selected choice = select();
+    return choice;
+}
+
+inline const char* kernelName() { return selected().name; }
+
+inline size_t find(std::string_view text, std::string_view needle) {
+    const size_t k = needle.size();
+    if (k > text.size()) return std::string_view::npos;
+    if (k < 2) return text.find(needle);   // memchr already handles single bytes well
+    return selected().kernel(text.data(), text.size(), needle.data(), k);
+}
+
+// find() with text and needle compared through map
+inline size_t find(std::string_view text, std::string_view needle, const ByteMap& map) {
+    if (map.isIdentity()) return find(text, needle);
+    const size_t k = needle.size();
+    if (k > text.size()) return std::string_view::npos;
+    ByteClass first;
+    ByteClass last;
+    if (k < 2 || !byteClassOf(map, needle[0], first) || !byteClassOf(map, needle[k - 1], last)) {
+        return map.find(text, needle);
+    }
+    return selected().mapped(text.data(), text.size(), needle.data(), k, first, last, map);
+}
+
+}  // namespace simd_find
+
+// Polynomial rolling hash over bytes:
+//   h(s) = sum((s[i] + 1) * base^(len-1-i)) mod modulus
+// Bytes are offset by one so that runs of '\0' still change the hash.
+// The default modulus is the Mersenne prime 2^61-1, reduced without division.
+// With a ByteMap set, each byte is mapped before it enters the hash, so strings that are
+// equal under the map hash alike.
+class RollingHasher {
+public:
+    static constexpr uint64_t MERSENNE_61 = (1ULL << 61) - 1;
+    static constexpr uint64_t DEFAULT_BASE = 1000003;
+
+    explicit RollingHasher(uint64_t base = DEFAULT_BASE, uint64_t modulus = MERSENNE_61)
+        : modulus(modulus) {
+        if (modulus < 2 || modulus > (1ULL << 63)) {
+            throw std::invalid_argument("RollingHasher: modulus must be in [2, 2^63]");
+        }
+        this->base = base % modulus;
+        if (this->base < 2) {
+            throw std::invalid_argument("RollingHasher: base must be >= 2 modulo the modulus");
+        }
+    }
+
+    uint64_t getBase() const { return base; }
+    uint64_t getModulus() const { return modulus; }
+
+    void setByteMap(const ByteMap& map) { byte_map = map; }
+    const ByteMap& getByteMap() const { return byte_map; }
+
+    // Hash of data[0, len)
+    uint64_t hash(const char* data, size_t len) const {
+        uint64_t h = 0;
+        for (size_t i = 0; i < len; i++) {
+            h = add(mul(h, base), symbol(data[i]));
+        }
+        return h;
+    }
+
+    uint64_t hash(std::string_view str) const {
+        return hash(str.data(), str.size());
+    }
+
+    // base^k mod modulus
+    uint64_t power(size_t k) const {
+        uint64_t result = 1 % modulus;
+        uint64_t b = base;
+        while (k > 0) {
+            if (k & 1) result = mul(result, b);
+            b = mul(b, b);
+            k >>= 1;
+        }
+        return result;
+    }
+
+    // Slide a window one byte to the right: drop `out` from the front and append `in`.
+    // `out_power` must be base^(window_length - 1).
+    uint64_t roll(uint64_t h, char out, char in, uint64_t out_power) const {
+        h = sub(h, mul(symbol(out), out_power));
+        return add(mul(h, base), symbol(in));
+    }
+
+    // Call f(offset, hash) for every window of length len in data[0, n), LANES at a time
+    // The windows are split into LANES contiguous lanes that roll independently, so the
+    // multiply chains of different lanes overlap in the pipeline instead of each roll
+    // waiting on the previous one. The dropped byte's contribution comes from a 256-entry
+    // table, leaving one multiply per roll. Hashes are produced into a LANES x BATCH block
+    // and handed to f block by block, so f sees offsets grouped by lane, not in text order.
+    template<size_t LANES = 4, size_t BATCH = 64, typename F>
+    void forEachWindowHashLanes(const char* data, size_t n, size_t len, F&& f) const {
+        if (modulus == MERSENNE_61) {
+            rollLanes<true, LANES, BATCH>(data, n, len, f);
+        } else {
+            rollLanes<false, LANES, BATCH>(data, n, len, f);
+        }
+    }
+
+private:
+    uint64_t base;
+    uint64_t modulus;
+    ByteMap byte_map;
+
+    template<bool MERSENNE, size_t LANES, size_t BATCH, typename F>
+    void rollLanes(const char* data, size_t n, size_t len, F& f) const {
+        if (len == 0 || len > n) return;
+        const size_t windows = n - len + 1;
+        const size_t per_lane = windows / LANES;
+        const uint64_t out_power = power(len - 1);
+        uint64_t drop[256];
+        for (unsigned c = 0; c < 256; c++) drop[c] = mul(symbol(static_cast<char>(c)), out_power);
+        const uint64_t m = MERSENNE ? MERSENNE_61 : modulus;
+        auto step_hash = [&](uint64_t h, char out, char in) {
+            const uint64_t d = drop[static_cast<unsigned char>(out)];
+            h = h >= d ? h - d : h + (m - d);
+            h = (MERSENNE ? mulMersenne(h, base) : mul(h, base)) + symbol(in);
+            return h >= m ? h - m : h;
+        };
+
+        uint64_t h[LANES];
+        size_t start[LANES];
+        for (size_t l = 0; l < LANES; l++) {
+            start[l] = l * per_lane;
+            h[l] = hash(data + start[l], len);
+        }
+
+        uint64_t block[BATCH][LANES];
+        for (size_t step = 0; step < per_lane;) {
+            const size_t steps = std::min(BATCH, per_lane - step);
+            for (size_t j = 0; j < steps; j++) {
+                const size_t offset = step + j;
+                if (offset > 0) {
+                    for (size_t l = 0; l < LANES; l++) {
+                        const char* window = data + start[l] + offset;
+                        h[l] = step_hash(h[l], window[-1], window[len - 1]);
+                    }
+                }
+                for (size_t l = 0; l < LANES; l++) block[j][l] = h[l];
+            }
+            for (size_t l = 0; l < LANES; l++) {
+                for (size_t j = 0; j < steps; j++) f(start[l] + step + j, block[j][l]);
+            }
+            step += steps;
+        }
+
+        // Windows left over after splitting evenly roll on from the end of the last lane
+        size_t offset = LANES * per_lane;
+        if (offset < windows) {
+            uint64_t tail = per_lane > 0 ? step_hash(h[LANES - 1], data[offset - 1], data[offset + len - 1])
+                                         : hash(data + offset, len);
+            f(offset, tail);
+            for (offset++; offset < windows; offset++) {
+                tail = step_hash(tail, data[offset - 1], data[offset + len - 1]);
+                f(offset, tail);
+            }
+        }
+    }
+
+    uint64_t symbol(char c) const {
+        return static_cast<uint64_t>(byte_map(c)) + 1;
+    }
+
+    static uint64_t mulMersenne(uint64_t a, uint64_t b) {
+        unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+        uint64_t folded = (static_cast<uint64_t>(product) & MERSENNE_61)
+                        + static_cast<uint64_t>(product >> 61);
+        return folded >= MERSENNE_61 ? folded - MERSENNE_61 : folded;
+    }
+
+    uint64_t mul(uint64_t a, uint64_t b) const {
+        if (modulus == MERSENNE_61) return mulMersenne(a, b);
+        return static_cast<uint64_t>(static_cast<unsigned __int128>(a) * b % modulus);
+    }
+
+    uint64_t add(uint64_t a, uint64_t b) const {
+        uint64_t sum = a + b;
+        return sum >= modulus ? sum - modulus : sum;
+    }
+
+    uint64_t sub(uint64_t a, uint64_t b) const {
+        return a >= b ? a - b : a + (modulus - b);
+    }
+};
+
+// How rollingHashSearch decides that a hash hit is a match
+enum class MatchMode {
+    Fast,        // single hash, hits are reported without checking characters
+    DoubleHash,  // two independent hashes must both hit, still no character check
+    Verified     // hits are confirmed with memcmp against a recorded window
+};
+
+// Page size behind large index tables
+// Random probes into a multi-GB table miss the TLB on almost every lookup with 4 KB
+// pages; 2 MB pages cover 512x more table per TLB entry and 1 GB pages 262144x more.
+enum class IndexPages {
+    Default,       // whatever operator new returns
+    Transparent,   // madvise(MADV_HUGEPAGE): 2 MB pages when the kernel can assemble them
+    Huge2M,        // MAP_HUGETLB 2 MB pages from the reserved pool, else Transparent
+    Huge1G         // MAP_HUGETLB 1 GB pages from the reserved pool, else Transparent
+};
+
+inline const char* indexPagesName(IndexPages pages) {
+    switch (pages) {
+        case IndexPages::Default: return "default";
+        case IndexPages::Transparent: return "transparent";
+        case IndexPages::Huge2M: return "2M";
+        case IndexPages::Huge1G: return "1G";
+    }
+    return "unknown";
+}
+
+// Where the pages of large index tables live on a multi-socket machine
+enum class NumaPlacement {
+    Default,      // first touch: the node of the thread that fills the table
+    Interleave,   // round-robin over all nodes, so no socket takes every remote miss
+    Replicate     // one copy per node; each query probes the copy on its own node
+};
+
+inline const char* numaPlacementName(NumaPlacement placement) {
+    switch (placement) {
+        case NumaPlacement::Default: return "default";
+        case NumaPlacement::Interleave: return "interleave";
+        case NumaPlacement::Replicate: return "replicate";
+    }
+    return "unknown";
+}
+
+// Memory policy of an index; see FlatHashTable::setMemoryPolicy
+struct IndexMemoryPolicy {
+    IndexPages pages = IndexPages::Default;
+    NumaPlacement placement = NumaPlacement::Default;
+    int node = -1;   // >= 0 binds the pages to this node, as for the per-node replicas
+
+    bool operator==(const IndexMemoryPolicy& other) const {
+        return pages == other.pages && placement == other.placement && node == other.node;
+    }
+    bool operator!=(const IndexMemoryPolicy& other) const { return !(*this == other); }
+};
+
+// Anonymous mappings with huge pages and NUMA policies, and the machine's NUMA layout
+// All of it is best effort: without huge pages, NUMA or permission to use them, tables
+// get ordinary pages on the default node and results are unchanged.
+namespace index_memory {
+
+constexpr size_t SMALL_PAGE = 4096;
+constexpr size_t HUGE_2M = size_t{1} << 21;
+constexpr size_t HUGE_1G = size_t{1} << 30;
+constexpr size_t MIN_MAPPED_BYTES = 64 << 10;   // smaller tables stay on the heap
+
+// Numbers in a sysfs list such as "0-3,8-11"
+inline std::vector<int> parseIdList(const std::string& text) {
+    std::vector<int> ids;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find(',', pos);
+        if (end == std::string::npos) end = text.size();
+        const std::string item = text.substr(pos, end - pos);
+        const size_t dash = item.find('-');
+        const int first = std::atoi(item.c_str());
+        const int last = dash == std::string::npos ? first : std::atoi(item.c_str() + dash + 1);
+        if (!item.empty() && item[0] >= '0' && item[0] <= '9') {
+            for (int id = first; id <= last; id++) ids.push_back(id);
+        }
+        pos = end + 1;
+    }
+    return ids;
+}
+
+inline std::string readLine(const std::string& path) {
+    std::ifstream in(path);
+    std::string line;
+    std::getline(in, line);
+    return line;
+}
+
+struct Topology {
+    std::vector<int> nodes = {0};       // online node ids
+    std::vector<int> node_of_cpu;       // empty on a single node
+};
+
+inline const Topology& topology() {
+    static const Topology instance = [] {
+        Topology t;
+#if defined(__linux__)
+        std::vector<int> online = parseIdList(readLine("/sys/devices/system/node/online"));
+        if (online.size() > 1) {
+            t.nodes = online;
+            for (int node : online) {
+                const std::string cpulist = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+                for (int cpu : parseIdList(readLine(cpulist))) {
+                    if (cpu >= static_cast<int>(t.node_of_cpu.size())) t.node_of_cpu.resize(cpu + 1, node);
+                    t.node_of_cpu[cpu] = node;
+                }
+            }
+        }
+#endif
+        return t;
+    }();
+    return instance;
+}
+
+inline const std::vector<int>& nodes() { return topology().nodes; }
+
+// Node of the CPU the calling thread runs on; 0 on a single node
+inline int currentNode() {
+    const Topology& t = topology();
+    if (t.node_of_cpu.empty()) return t.nodes[0];
+#if defined(ROLLING_HASHSET_HAS_NUMA)
+    const int cpu = sched_getcpu();
+    if (cpu >= 0 && cpu < static_cast<int>(t.node_of_cpu.size())) return t.node_of_cpu[cpu];
+#endif
+    return t.nodes[0];
+}
+
+inline size_t hugePageBytes(IndexPages pages) {
+    switch (pages) {
+        case IndexPages::Huge2M: return HUGE_2M;
+        case IndexPages::Huge1G: return HUGE_1G;
+        case IndexPages::Default:
+        case IndexPages::Transparent: break;
+    }
+    return 0;
+}
+
+inline bool mapped(size_t bytes, const IndexMemoryPolicy& policy) {
+#if defined(__unix__) || defined(__APPLE__)
+    const bool numa = policy.node >= 0 || policy.placement == NumaPlacement::Interleave;
+    return bytes >= MIN_MAPPED_BYTES && (policy.pages != IndexPages::Default || numa);
+#else
+    (void)bytes;
+    (void)policy;
+    return false;
+#endif
+}
+
+// Length of the mapping for bytes; tables of at least half a huge page are rounded up to
+// whole huge pages so the pool can back them
+inline size_t mappedLength(size_t bytes, const IndexMemoryPolicy& policy) {
+    const size_t huge = hugePageBytes(policy.pages);
+    const size_t unit = huge && bytes >= huge / 2 ? huge : SMALL_PAGE;
+    return (bytes + unit - 1) / unit * unit;
+}
+
+inline void applyNumaPolicy(void* address, size_t length, const IndexMemoryPolicy& policy) {
+#if defined(ROLLING_HASHSET_HAS_NUMA)
+    const std::vector<int>& online = nodes();
+    if (online.size() < 2) return;
+    constexpr size_t WORD_BITS = 8 * sizeof(unsigned long);
+    int mode;
+    std::vector<unsigned long> mask(static_cast<size_t>(online.back()) / WORD_BITS + 1, 0);
+    auto set = [&mask](int node) { mask[static_cast<size_t>(node) / WORD_BITS] |= 1UL << (node % WORD_BITS); };
+    if (policy.node >= 0) {
+        mode = MPOL_BIND;
+        set(policy.node);
+    } else if (policy.placement == NumaPlacement::Interleave) {
+        mode = MPOL_INTERLEAVE;
+        for (int node : online) set(node);
+    } else {
+        return;
+    }
+    ::syscall(SYS_mbind, address, length, mode, mask.data(), mask.size() * WORD_BITS + 1, 0);
+#else
+    (void)address;
+    (void)length;
+    (void)policy;
+#endif
+}
+
+inline void* allocate(size_t bytes, const IndexMemoryPolicy& policy) {
+    if (!mapped(bytes, policy)) return ::operator new(bytes);
+#if defined(__unix__) || defined(__APPLE__)
+    const size_t length = mappedLength(bytes, policy);
+    void* address = MAP_FAILED;
+#if defined(MAP_HUGETLB) && defined(MAP_HUGE_SHIFT)
+    const size_t huge = hugePageBytes(policy.pages);
+    if (huge && length % huge == 0) {
+        const int size_flag = (huge == HUGE_1G ? 30 : 21) << MAP_HUGE_SHIFT;
+        address = ::mmap(nullptr, length, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | size_flag, -1, 0);
+    }
+#endif
+    if (address == MAP_FAILED) {
+        address = ::mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (address == MAP_FAILED) throw std::bad_alloc();
+#if defined(MADV_HUGEPAGE)
+        if (policy.pages != IndexPages::Default) ::madvise(address, length, MADV_HUGEPAGE);
+#endif
+    }
+    // Before first touch, so the policy decides where every page is faulted in
+    applyNumaPolicy(address, length, policy);
+    return address;
+#else
+    return ::operator new(bytes);
+#endif
+}
+
+inline void deallocate(void* address, size_t bytes, const IndexMemoryPolicy& policy) {
+    if (!mapped(bytes, policy)) {
+        ::operator delete(address);
+        return;
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    ::munmap(address, mappedLength(bytes, policy));
+#endif
+}
+
+}  // namespace index_memory
+
+// Allocator for index tables that places them according to an IndexMemoryPolicy
+// The policy travels with the container on copy, move and swap.
+template<typename T>
+class IndexAllocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    IndexAllocator() = default;
+    explicit IndexAllocator(const IndexMemoryPolicy& policy) : policy(policy) {}
+    template<typename U>
+    IndexAllocator(const IndexAllocator<U>& other) : policy(other.getPolicy()) {}
+
+    T* allocate(size_t n) { return static_cast<T*>(index_memory::allocate(n * sizeof(T), policy)); }
+    void deallocate(T* p, size_t n) { index_memory::deallocate(p, n * sizeof(T), policy); }
+
+    const IndexMemoryPolicy& getPolicy() const { return policy; }
+
+    template<typename U>
+    bool operator==(const IndexAllocator<U>& other) const { return policy == other.getPolicy(); }
+    template<typename U>
+    bool operator!=(const IndexAllocator<U>& other) const { return policy != other.getPolicy(); }
+
+private:
+    IndexMemoryPolicy policy;
+};
+
+template<typename T>
+using IndexVector = std::vector<T, IndexAllocator<T>>;
+
+// Open-addressing hash table keyed by 64-bit hashes
+// Slots are grouped 16 at a time with one control byte each, holding either EMPTY or
+// 7 bits of the mixed key. A probe compares a whole group of control bytes at once
+// (SSE2 when available) and only touches key slots whose tag matches, then moves on
+// to the next group linearly. Keys and values live in flat arrays with no per-entry
+// allocation. Value = void gives a set.
+template<typename Value = void>
+class FlatHashTable {
+public:
+    static constexpr size_t GROUP_SIZE = 16;
+    static constexpr bool HAS_VALUE = !std::is_void<Value>::value;
+    using StoredValue = std::conditional_t<HAS_VALUE, Value, char>;
+    // Element type for insertPartitioned
+    using Entry = std::conditional_t<HAS_VALUE, std::pair<uint64_t, StoredValue>, uint64_t>;
+
+    FlatHashTable() = default;
+
+    // Copy of other whose slot arrays are allocated under policy, e.g. on another node
+    FlatHashTable(const FlatHashTable& other, const IndexMemoryPolicy& policy)
+        : ctrl(other.ctrl, IndexAllocator<int8_t>(policy)),
+          keys(other.keys, IndexAllocator<uint64_t>(policy)),
+          values(other.values, IndexAllocator<StoredValue>(policy)),
+          count(other.count), tombstones(other.tombstones), memory_policy(policy) {}
+
+    FlatHashTable(const FlatHashTable&) = default;
+    FlatHashTable(FlatHashTable&&) = default;
+    FlatHashTable& operator=(const FlatHashTable&) = default;
+    FlatHashTable& operator=(FlatHashTable&&) = default;
+
+    // Page size and NUMA placement of the slot arrays; a filled table moves to new storage
+    void setMemoryPolicy(const IndexMemoryPolicy& policy) {
+        if (policy == memory_policy) return;
+        memory_policy = policy;
+        if (capacity()) rehash(capacity());
+    }
+
+    const IndexMemoryPolicy& getMemoryPolicy() const { return memory_policy; }
+
+    // Size the table so that n keys fit under the maximum load factor
+    void reserve(size_t n) {
+        size_t needed = GROUP_SIZE;
+        while (needed * MAX_LOAD_NUM < n * MAX_LOAD_DEN) needed *= 2;
+        if (needed > capacity()) rehash(needed);
+    }
+
+    // Insert key if absent; returns true when it was inserted
+    bool insert(uint64_t key) {
+        static_assert(!HAS_VALUE, "use emplace() on a map");
+        return insertSlot(key).second;
+    }
+
+    // Insert key -> value if key is absent; an existing value is left untouched
+    template<typename V = Value>
+    bool emplace(uint64_t key, const std::enable_if_t<!std::is_void<V>::value, V>& value) {
+        auto [slot, inserted] = insertSlot(key);
+        if (inserted) values[slot] = value;
+        return inserted;
+    }
+
+    bool contains(uint64_t key) const { return findSlot(key) != NPOS; }
+
+    // Start loading the control group and key slots where key's probe begins, so a
+    // contains() or find() issued a little later does not wait on memory
+    void prefetch(uint64_t key) const {
+        if (ctrl.empty()) return;
+        const size_t base = groupOf(mix(key)) * GROUP_SIZE;
+        __builtin_prefetch(ctrl.data() + base);
+        __builtin_prefetch(keys.data() + base);
+        __builtin_prefetch(keys.data() + base + GROUP_SIZE / 2);
+    }
+
+    template<typename V = Value>
+    const std::enable_if_t<!std::is_void<V>::value, V>* find(uint64_t key) const {
+        size_t slot = findSlot(key);
+        return slot == NPOS ? nullptr : &values[slot];
+    }
+
+    template<typename V = Value>
+    std::enable_if_t<!std::is_void<V>::value, V>* find(uint64_t key) {
+        size_t slot = findSlot(key);
+        return slot == NPOS ? nullptr : &values[slot];
+    }
+
+    // Remove key; returns true when it was present
+    // The slot becomes a tombstone so that probe chains through it stay intact; inserts
+    // reuse tombstones and a rehash drops them.
+    bool erase(uint64_t key) {
+        size_t slot = findSlot(key);
+        if (slot == NPOS) return false;
+        ctrl[slot] = DELETED;
+        count--;
+        tombstones++;
+        return true;
+    }
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    size_t capacity() const { return ctrl.size(); }
+    double loadFactor() const { return capacity() ? static_cast<double>(count) / capacity() : 0.0; }
+
+    size_t memoryBytes() const {
+        return ctrl.size() + keys.size() * sizeof(uint64_t) + values.size() * sizeof(StoredValue);
+    }
+
+    void clear() {
+        ctrl.clear();
+        keys.clear();
+        values.clear();
+        count = 0;
+        tombstones = 0;
+    }
+
+    // Remove every entry but keep the slots, so refilling to a similar size does not allocate
+    void clearEntries() {
+        std::fill(ctrl.begin(), ctrl.end(), EMPTY);
+        count = 0;
+        tombstones = 0;
+    }
+
+    // The groups are split into `owners` contiguous ranges; this is the range holding
+    // key's home group. Only meaningful while the capacity stays unchanged.
+    size_t ownerOf(uint64_t key, size_t owners) const {
+        return groupOf(mix(key)) * owners / (ctrl.size() / GROUP_SIZE);
+    }
+
+    // Insert entries from several producers with one worker per owner range
+    // parts[p][o] holds producer p's entries whose ownerOf(key, parts[p].size()) is o.
+    // Each worker probes only inside its own range, so workers never touch the same slot;
+    // a probe that would run past the end of its range is deferred and inserted afterwards
+    // on the calling thread. Call reserve() for the total entry count first.
+    void insertPartitioned(const std::vector<std::vector<std::vector<Entry>>>& parts) {
+        if (parts.empty()) return;
+        const size_t owners = parts[0].size();
+        const size_t groups = ctrl.size() / GROUP_SIZE;
+        std::vector<std::vector<Entry>> deferred(owners);
+        std::vector<size_t> inserted(owners, 0);
+
+        parallelFor(owners, [&](size_t o) {
+            const size_t first_group = (o * groups + owners - 1) / owners;
+            const size_t end_group = ((o + 1) * groups + owners - 1) / owners;
+            for (const auto& producer : parts) {
+                for (const Entry& entry : producer[o]) {
+                    int outcome = insertWithinGroups(entry, first_group, end_group);
+                    if (outcome > 0) inserted[o]++;
+                    else if (outcome < 0) deferred[o].push_back(entry);
+                }
+            }
+        });
+
+        for (size_t n : inserted) count += n;
+        for (const auto& entries : deferred) {
+            for (const Entry& entry : entries) {
+                if constexpr (HAS_VALUE) emplace(entry.first, entry.second);
+                else insert(entry);
+            }
+        }
+    }
+
+    // Raw slot arrays (capacity() entries each), e.g. for serializing a set
+    const int8_t* controlBytes() const { return ctrl.data(); }
+    const uint64_t* keyData() const { return keys.data(); }
+
+    static constexpr size_t NPOS = static_cast<size_t>(-1);
+
+    // Slot holding key in raw slot arrays of this layout, or NPOS
+    // capacity must be a power of two multiple of GROUP_SIZE; used directly on mapped memory.
+    static size_t findIn(const int8_t* ctrl_bytes, const uint64_t* key_data, size_t capacity, uint64_t key) {
+        if (capacity == 0) return NPOS;
+        const uint64_t mixed = mix(key);
+        const int8_t tag = tagOf(mixed);
+        const size_t group_mask = capacity / GROUP_SIZE - 1;
+        for (size_t g = static_cast<size_t>(mixed >> 7) & group_mask;; g = (g + 1) & group_mask) {
+            const size_t base = g * GROUP_SIZE;
+            for (uint32_t m = matchGroupAt(ctrl_bytes, base, tag); m; m &= m - 1) {
+                size_t slot = base + lowestBit(m);
+                if (key_data[slot] == key) return slot;
+            }
+            if (matchGroupAt(ctrl_bytes, base, EMPTY)) return NPOS;
+        }
+    }
+
+    // Call f(key) or f(key, value) for every entry
+    template<typename F>
+    void forEach(F&& f) const {
+        for (size_t i = 0; i < ctrl.size(); i++) {
+            if (ctrl[i] < 0) continue;   // empty or deleted
+            if constexpr (HAS_VALUE) f(keys[i], values[i]);
+            else f(keys[i]);
+        }
+    }
+
+private:
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;   // tombstone left by erase(); tags are 0..127
+    static constexpr size_t MAX_LOAD_NUM = 7;
+    static constexpr size_t MAX_LOAD_DEN = 8;
+
+    IndexVector<int8_t> ctrl;
+    IndexVector<uint64_t> keys;
+    IndexVector<StoredValue> values;
+    size_t count = 0;
+    size_t tombstones = 0;
+    IndexMemoryPolicy memory_policy;
+
+    static uint64_t mix(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    static int8_t tagOf(uint64_t mixed) { return static_cast<int8_t>(mixed & 0x7f); }
+
+    size_t groupOf(uint64_t mixed) const {
+        return static_cast<size_t>(mixed >> 7) & (ctrl.size() / GROUP_SIZE - 1);
+    }
+
+    // Bit i set when control byte i of the group at base equals byte
+    static uint32_t matchGroupAt(const int8_t* ctrl_bytes, size_t base, int8_t byte) {
+#if defined(__SSE2__)
+        __m128i group = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl_bytes + base));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte))));
+#else
+        uint32_t mask = 0;
+        for (size_t i = 0; i < GROUP_SIZE; i++) {
+            if (ctrl_bytes[base + i] == byte) mask |= 1u << i;
+        }
+        return mask;
+#endif
+    }
+
+    uint32_t matchGroup(size_t base, int8_t byte) const { return matchGroupAt(ctrl.data(), base, byte); }
+
+    static unsigned lowestBit(uint32_t mask) { return static_cast<unsigned>(__builtin_ctz(mask)); }
+
+    size_t findSlot(uint64_t key) const {
+        if (count == 0) return NPOS;
+        return findIn(ctrl.data(), keys.data(), ctrl.size(), key);
+    }
+
+    std::pair<size_t, bool> insertSlot(uint64_t key) {
+        if ((count + 1) * MAX_LOAD_DEN > capacity() * MAX_LOAD_NUM) {
+            rehash(capacity() ? capacity() * 2 : GROUP_SIZE);
+        } else if ((count + tombstones + 1) * MAX_LOAD_DEN > capacity() * MAX_LOAD_NUM) {
+            rehash(capacity());   // same size, drops the tombstones
+        }
+        const uint64_t mixed = mix(key);
+        const int8_t tag = tagOf(mixed);
+        const size_t group_mask = ctrl.size() / GROUP_SIZE - 1;
+        size_t reuse = NPOS;   // first tombstone on the probe path
+        for (size_t g = groupOf(mixed);; g = (g + 1) & group_mask) {
+            const size_t base = g * GROUP_SIZE;
+            for (uint32_t m = matchGroup(base, tag); m; m &= m - 1) {
+                size_t slot = base + lowestBit(m);
+                if (keys[slot] == key) return {slot, false};
+            }
+            if (tombstones && reuse == NPOS) {
+                if (uint32_t deleted = matchGroup(base, DELETED)) reuse = base + lowestBit(deleted);
+            }
+            if (uint32_t empty = matchGroup(base, EMPTY)) {
+                size_t slot = base + lowestBit(empty);
+                if (reuse != NPOS) {
+                    slot = reuse;
+                    tombstones--;
+                }
+                ctrl[slot] = tag;
+                keys[slot] = key;
+                count++;
+                return {slot, true};
+            }
+        }
+    }
+
+    // Insert without growing, probing only groups [first_group, end_group)
+    // Returns 1 when inserted, 0 when already present, -1 when the range ran out.
+    // Does not update count.
+    int insertWithinGroups(const Entry& entry, size_t first_group, size_t end_group) {
+        uint64_t key;
+        if constexpr (HAS_VALUE) key = entry.first;
+        else key = entry;
+        const uint64_t mixed = mix(key);
+        const int8_t tag = tagOf(mixed);
+        size_t g = groupOf(mixed);
+        if (g < first_group || g >= end_group) return -1;
+        for (; g < end_group; g++) {
+            const size_t base = g * GROUP_SIZE;
+            for (uint32_t m = matchGroup(base, tag); m; m &= m - 1) {
+                if (keys[base + lowestBit(m)] == key) return 0;
+            }
+            if (uint32_t empty = matchGroup(base, EMPTY)) {
+                size_t slot = base + lowestBit(empty);
+                ctrl[slot] = tag;
+                keys[slot] = key;
+                if constexpr (HAS_VALUE) values[slot] = entry.second;
+                return 1;
+            }
+        }
+        return -1;
+    }
+
+    void rehash(size_t new_capacity) {
+        IndexVector<int8_t> old_ctrl = std::move(ctrl);
+        IndexVector<uint64_t> old_keys = std::move(keys);
+        IndexVector<StoredValue> old_values = std::move(values);
+        ctrl = IndexVector<int8_t>(new_capacity, EMPTY, IndexAllocator<int8_t>(memory_policy));
+        keys = IndexVector<uint64_t>(new_capacity, 0, IndexAllocator<uint64_t>(memory_policy));
+        values = IndexVector<StoredValue>(HAS_VALUE ? new_capacity : 0, StoredValue{},
+                                          IndexAllocator<StoredValue>(memory_policy));
+        count = 0;
+        tombstones = 0;
+        for (size_t i = 0; i < old_ctrl.size(); i++) {
+            if (old_ctrl[i] < 0) continue;
+            size_t slot = insertSlot(old_keys[i]).first;
+            if constexpr (HAS_VALUE) values[slot] = std::move(old_values[i]);
+        }
+    }
+};
+
+using FlatHashSet = FlatHashTable<void>;
+template<typename Value>
+using FlatHashMap = FlatHashTable<Value>;
+
+// Blocked Bloom filter over 64-bit keys
+// Every key sets k bits inside a single 512-bit block (one cache line), so a lookup
+// costs at most one cache miss. The bit budget is bits_per_key per expected key,
+// capped at max_bytes so the filter can be kept L2-resident in front of a much larger
+// table; when the cap applies, k is lowered to suit the bits actually available.
+class BlockedBloomFilter {
+public:
+    static constexpr size_t BLOCK_BITS = 512;
+    static constexpr size_t WORDS_PER_BLOCK = BLOCK_BITS / 64;
+
+    BlockedBloomFilter() = default;
+
+    BlockedBloomFilter(size_t expected_keys, double bits_per_key, size_t max_bytes) {
+        reset(expected_keys, bits_per_key, max_bytes);
+    }
+
+    // Empty the filter and resize it for expected_keys, reusing the existing storage when it fits
+    void reset(size_t expected_keys, double bits_per_key, size_t max_bytes) {
+        double wanted_bits = std::max(1.0, static_cast<double>(expected_keys) * bits_per_key);
+        double budget_bits = static_cast<double>(std::max<size_t>(max_bytes, BLOCK_BITS / 8)) * 8.0;
+        block_count = static_cast<size_t>(std::ceil(std::min(wanted_bits, budget_bits) / BLOCK_BITS));
+        block_count = std::max<size_t>(block_count, 1);
+        words.assign(block_count * WORDS_PER_BLOCK, 0);
+        double actual_bits_per_key = static_cast<double>(block_count * BLOCK_BITS) /
+                                     static_cast<double>(std::max<size_t>(expected_keys, 1));
+        k = static_cast<unsigned>(std::lround(actual_bits_per_key * 0.6931));
+        k = std::min(std::max(k, 1u), MAX_K);
+        inserted = 0;
+    }
+
+    void insert(uint64_t key) {
+        uint64_t* block = blockFor(key);
+        uint64_t bits = bitSource(key);
+        for (unsigned i = 0; i < k; i++, bits >>= 9) {
+            const unsigned bit = static_cast<unsigned>(bits & (BLOCK_BITS - 1));
+            block[bit >> 6] |= 1ULL << (bit & 63);
+        }
+        inserted++;
+    }
+
+    bool mayContain(uint64_t key) const {
+        if (words.empty()) return true;
+        const uint64_t* block = blockFor(key);
+        uint64_t bits = bitSource(key);
+        for (unsigned i = 0; i < k; i++, bits >>= 9) {
+            const unsigned bit = static_cast<unsigned>(bits & (BLOCK_BITS - 1));
+            if (!(block[bit >> 6] & (1ULL << (bit & 63)))) return false;
+        }
+        return true;
+    }
+
+    bool empty() const { return words.empty(); }
+    size_t memoryBytes() const { return words.size() * sizeof(uint64_t); }
+    size_t size() const { return inserted; }
+    unsigned hashCount() const { return k; }
+
+    // Standard (1 - e^(-kn/m))^k estimate; blocking makes the real rate slightly higher
+    double estimatedFalsePositiveRate() const {
+        if (words.empty()) return 1.0;
+        double m = static_cast<double>(block_count * BLOCK_BITS);
+        return std::pow(1.0 - std::exp(-static_cast<double>(k) * inserted / m), k);
+    }
+
+private:
+    static constexpr unsigned MAX_K = 7;   // 7 x 9-bit positions come from one 64-bit hash
+
+    std::vector<uint64_t> words;
+    size_t block_count = 0;
+    size_t inserted = 0;
+    unsigned k = 1;
+
+    static uint64_t mix(uint64_t key) {
+        key ^= key >> 31;
+        key *= 0x7fb5d329728ea185ULL;
+        key ^= key >> 27;
+        key *= 0x81dadef4bc2dd44dULL;
+        key ^= key >> 33;
+        return key;
+    }
+
+    size_t blockIndex(uint64_t key) const {
+        return static_cast<size_t>((static_cast<unsigned __int128>(mix(key)) * block_count) >> 64);
+    }
+
+    uint64_t* blockFor(uint64_t key) { return words.data() + blockIndex(key) * WORDS_PER_BLOCK; }
+    const uint64_t* blockFor(uint64_t key) const { return words.data() + blockIndex(key) * WORDS_PER_BLOCK; }
+
+    static uint64_t bitSource(uint64_t key) { return mix(key ^ 0x9e3779b97f4a7c15ULL); }
+};
+
+// Hash index split into one bucket per window length, so a pattern is only ever
+// probed against windows of its own length and only queried lengths are hashed
+template<typename Bucket>
+class LengthBucketedIndex {
+public:
+    LengthBucketedIndex() = default;
+
+    // Copy of other with every bucket allocated under policy
+    LengthBucketedIndex(const LengthBucketedIndex& other, const IndexMemoryPolicy& policy)
+        : memory_policy(policy) {
+        for (const auto& [length, b] : other.buckets) buckets.emplace(length, Bucket(b, policy));
+    }
+
+    Bucket& bucket(size_t length) {
+        auto [it, inserted] = buckets.try_emplace(length);
+        if (inserted) it->second.setMemoryPolicy(memory_policy);
+        return it->second;
+    }
+
+    // Page size and NUMA placement for every bucket, present and future
+    void setMemoryPolicy(const IndexMemoryPolicy& policy) {
+        memory_policy = policy;
+        for (auto& [length, b] : buckets) b.setMemoryPolicy(policy);
+    }
+
+    const IndexMemoryPolicy& getMemoryPolicy() const { return memory_policy; }
+
+    const Bucket* find(size_t length) const {
+        auto it = buckets.find(length);
+        return it == buckets.end() ? nullptr : &it->second;
+    }
+
+    bool hasLength(size_t length) const { return buckets.count(length) != 0; }
+    size_t bucketCount() const { return buckets.size(); }
+    bool empty() const { return buckets.empty(); }
+
+    // Empty every bucket but keep the buckets and their storage for reuse
+    void clearEntries() {
+        for (auto& [length, b] : buckets) b.clearEntries();
+    }
+
+    size_t memoryBytes() const {
+        size_t total = 0;
+        for (const auto& [length, b] : buckets) total += b.memoryBytes();
+        return total;
+    }
+
+    // Total number of entries across all buckets
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& [length, b] : buckets) total += b.size();
+        return total;
+    }
+
+    // Total slots across all buckets
+    size_t capacity() const {
+        size_t total = 0;
+        for (const auto& [length, b] : buckets) total += b.capacity();
+        return total;
+    }
+
+    std::vector<size_t> lengths() const {
+        std::vector<size_t> result;
+        result.reserve(buckets.size());
+        for (const auto& [length, b] : buckets) result.push_back(length);
+        return result;
+    }
+
+    auto begin() const { return buckets.begin(); }
+    auto end() const { return buckets.end(); }
+
+private:
+    std::map<size_t, Bucket> buckets;
+    IndexMemoryPolicy memory_policy;
+};
+
+using SubstringHashIndex = LengthBucketedIndex<FlatHashSet>;
+// hash -> offset of the first window with that hash
+using VerifiedSubstringIndex = LengthBucketedIndex<FlatHashMap<size_t>>;
+
+// Aho-Corasick automaton over a fixed pattern set
+// The trie is renumbered in BFS order and flattened into CSR arrays: the outgoing edges
+// of state s are edge_label/edge_target[edge_begin[s], edge_begin[s+1]), sorted by label.
+// The root keeps a dense 256-entry table since almost every failure chain ends there.
+// One scan of the text finds every pattern regardless of how many there are.
+// Under a ByteMap the trie is labelled with mapped bytes and text bytes are mapped as
+// they are scanned.
+class AhoCorasickAutomaton {
+public:
+    AhoCorasickAutomaton() = default;
+    explicit AhoCorasickAutomaton(const std::vector<std::string>& patterns, const ByteMap& map = {}) {
+        build(toPatternViews(patterns), map);
+    }
+    explicit AhoCorasickAutomaton(const PatternViews& patterns, const ByteMap& map = {}) { build(patterns, map); }
+
+    void build(const PatternViews& patterns, const ByteMap& map = {}) {
+        pattern_count = patterns.size();
+        has_empty_pattern = false;
+        byte_map = map;
+
+        // Pointer trie first; it is discarded once flattened
+        struct BuildNode {
+            std::vector<std::pair<unsigned char, uint32_t>> children;
+            std::vector<uint32_t> outputs;
+        };
+        std::vector<BuildNode> trie(1);
+        for (uint32_t id = 0; id < patterns.size(); id++) {
+            uint32_t node = 0;
+            for (char ch : patterns[id]) {
+                unsigned char c = map(ch);
+                auto& children = trie[node].children;
+                auto it = std::find_if(children.begin(), children.end(),
+                                       [c](const auto& edge) { return edge.first == c; });
+                if (it != children.end()) {
+                    node = it->second;
+                } else {
+                    uint32_t child = static_cast<uint32_t>(trie.size());
+                    trie[node].children.emplace_back(c, child);
+                    trie.emplace_back();
+                    node = child;
+                }
+            }
+            if (node == 0) has_empty_pattern = true;
+            trie[node].outputs.push_back(id);
+        }
+
+        // BFS renumbering and CSR flattening
+        std::vector<uint32_t> order{0};
+        std::vector<uint32_t> new_id(trie.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            auto& children = trie[order[i]].children;
+            std::sort(children.begin(), children.end());
+            for (const auto& edge : children) {
+                new_id[edge.second] = static_cast<uint32_t>(order.size());
+                order.push_back(edge.second);
+            }
+        }
+
+        const size_t states = trie.size();
+        edge_begin.assign(states + 1, 0);
+        edge_label.clear();
+        edge_target.clear();
+        output_begin.assign(states + 1, 0);
+        output_ids.clear();
+        for (size_t s = 0; s < states; s++) {
+            const BuildNode& node = trie[order[s]];
+            edge_begin[s] = static_cast<uint32_t>(edge_label.size());
+            for (const auto& edge : node.children) {
+                edge_label.push_back(edge.first);
+                edge_target.push_back(new_id[edge.second]);
+            }
+            output_begin[s] = static_cast<uint32_t>(output_ids.size());
+            output_ids.insert(output_ids.end(), node.outputs.begin(), node.outputs.end());
+        }
+        edge_begin[states] = static_cast<uint32_t>(edge_label.size());
+        output_begin[states] = static_cast<uint32_t>(output_ids.size());
+
+        std::fill(std::begin(root_next), std::end(root_next), 0u);
+        for (uint32_t e = edge_begin[0]; e < edge_begin[1]; e++) {
+            root_next[edge_label[e]] = edge_target[e];
+        }
+
+        // Failure and dictionary-suffix links; BFS order guarantees parents are done first
+        fail.assign(states, 0);
+        dict_link.assign(states, NONE);
+        for (uint32_t s = 0; s < states; s++) {
+            for (uint32_t e = edge_begin[s]; e < edge_begin[s + 1]; e++) {
+                uint32_t child = edge_target[e];
+                uint32_t f = s == 0 ? 0 : next(fail[s], edge_label[e]);
+                fail[child] = f;
+                dict_link[child] = (f != 0 && isTerminal(f)) ? f : dict_link[f];
+            }
+        }
+    }
+
+    // found[id] is set for every pattern that occurs in data[0, n)
+    std::vector<bool> findPresent(const char* data, size_t n) const {
+        std::vector<bool> found(pattern_count, false);
+        std::vector<char> seen(fail.size(), 0);
+        size_t remaining_terminals = 0;
+        for (uint32_t s = 1; s < fail.size(); s++) {
+            if (isTerminal(s)) remaining_terminals++;
+        }
+        // The root's outputs are reported up front and it is not counted as a terminal
+        if (has_empty_pattern) {
+            markOutputs(0, found);
+            seen[0] = 1;
+        }
+
+        uint32_t state = 0;
+        for (size_t i = 0; i < n && remaining_terminals > 0; i++) {
+            state = next(state, byte_map(data[i]));
+            // A seen state has had its whole dictionary-suffix chain reported already
+            for (uint32_t t = isTerminal(state) ? state : dict_link[state];
+                 t != NONE && !seen[t]; t = dict_link[t]) {
+                seen[t] = 1;
+                markOutputs(t, found);
+                remaining_terminals--;
+            }
+        }
+        return found;
+    }
+
+    size_t patternCount() const { return pattern_count; }
+    size_t stateCount() const { return fail.size(); }
+
+    size_t memoryBytes() const {
+        return sizeof(root_next) +
+               (edge_begin.size() + edge_target.size() + fail.size() + dict_link.size() +
+                output_begin.size() + output_ids.size()) * sizeof(uint32_t) +
+               edge_label.size();
+    }
+
+private:
+    static constexpr uint32_t NONE = static_cast<uint32_t>(-1);
+
+    std::vector<uint32_t> edge_begin;
+    std::vector<unsigned char> edge_label;
+    std::vector<uint32_t> edge_target;
+    std::vector<uint32_t> fail;
+    std::vector<uint32_t> dict_link;   // nearest proper suffix state that ends a pattern
+    std::vector<uint32_t> output_begin;
+    std::vector<uint32_t> output_ids;
+    uint32_t root_next[256] = {};
+    size_t pattern_count = 0;
+    bool has_empty_pattern = false;
+    ByteMap byte_map;
+
+    bool isTerminal(uint32_t s) const { return output_begin[s] != output_begin[s + 1]; }
+
+    void markOutputs(uint32_t s, std::vector<bool>& found) const {
+        for (uint32_t o = output_begin[s]; o < output_begin[s + 1]; o++) found[output_ids[o]] = true;
+    }
+
+    uint32_t next(uint32_t state, unsigned char c) const {
+        while (state != 0) {
+            const unsigned char* first = edge_label.data() + edge_begin[state];
+            const unsigned char* last = edge_label.data() + edge_begin[state + 1];
+            const unsigned char* it = std::lower_bound(first, last, c);
+            if (it != last && *it == c) return edge_target[it - edge_label.data()];
+            state = fail[state];
+        }
+        return root_next[c];
+    }
+};
+
+// Patterns hashed per distinct length, for rolling over a text and probing each window
+// Patterns with the same length and hash share a candidate group, so a hit yields every
+// pattern that might match; callers confirm candidates with memcmp. Empty patterns are
+// kept aside since they have no window.
+class PatternHashTable {
+public:
+    struct LengthSlot {
+        size_t length;
+        uint64_t out_power;            // base^(length - 1), for rolling
+        FlatHashMap<size_t> groups;    // pattern hash -> index into candidate groups
+        size_t pattern_count;          // patterns of this length, duplicates included
+    };
+
+    PatternHashTable() = default;
+
+    PatternHashTable(const PatternViews& patterns, const RollingHasher& hasher) {
+        std::map<size_t, size_t> slot_of_length;
+        for (size_t id = 0; id < patterns.size(); id++) {
+            const size_t len = patterns[id].length();
+            if (len == 0) {
+                empty_patterns.push_back(id);
+                continue;
+            }
+            auto [it, added] = slot_of_length.emplace(len, 0);
+            if (added) slots.push_back(LengthSlot{len, hasher.power(len - 1), {}, 0});
+            max_len = std::max(max_len, len);
+        }
+        std::sort(slots.begin(), slots.end(),
+                  [](const LengthSlot& a, const LengthSlot& b) { return a.length < b.length; });
+        for (size_t i = 0; i < slots.size(); i++) slot_of_length[slots[i].length] = i;
+
+        for (size_t id = 0; id < patterns.size(); id++) {
+            if (patterns[id].empty()) continue;
+            LengthSlot& slot = slots[slot_of_length[patterns[id].length()]];
+            const uint64_t h = hasher.hash(patterns[id]);
+            if (slot.groups.emplace(h, groups.size())) groups.emplace_back();
+            groups[*slot.groups.find(h)].push_back(id);
+            slot.pattern_count++;
+        }
+    }
+
+    // Slots in ascending length order
+    const std::vector<LengthSlot>& lengthSlots() const { return slots; }
+
+    // Ids of patterns in slot whose hash is h, or nullptr
+    const std::vector<size_t>* candidates(size_t slot, uint64_t h) const {
+        const size_t* group = slots[slot].groups.find(h);
+        return group ? &groups[*group] : nullptr;
+    }
+
+    const std::vector<size_t>& emptyPatterns() const { return empty_patterns; }
+    size_t maxLength() const { return max_len; }
+
+private:
+    std::vector<LengthSlot> slots;
+    std::vector<std::vector<size_t>> groups;
+    std::vector<size_t> empty_patterns;
+    size_t max_len = 0;
+};
+
+// Searches a stream of chunks for a fixed pattern set without holding the whole input
+// Patterns are hashed per length up front. Each chunk is appended to the last
+// max_len bytes of the previous one, every length's rolling hash is carried across
+// the boundary, and each hash hit is confirmed with memcmp before it is reported.
+// Memory stays at one chunk plus the tail plus the pattern tables.
+class StreamingSearcher {
+public:
+    // Called for every occurrence: pattern index and absolute offset in the stream
+    using MatchCallback = std::function<void(size_t pattern_id, uint64_t offset)>;
+
+    StreamingSearcher(const std::vector<std::string>& patterns, MatchCallback on_match = {},
+                      const RollingHasher& hasher = RollingHasher())
+        : patterns(patterns), on_match(std::move(on_match)), hasher(hasher),
+          table(toPatternViews(this->patterns), hasher),
+          rolling(table.lengthSlots().size(), 0),
+          found(patterns.size(), false),
+          max_len(table.maxLength()) {
+        // The empty pattern occurs in every stream
+        for (size_t id : table.emptyPatterns()) found[id] = true;
+    }
+
+    // Process the next chunk of the stream
+    void feed(const char* data, size_t len) {
+        if (len == 0) return;
+        const size_t base = buffer.size();
+        buffer.append(data, len);
+        const char* buf = buffer.data();
+        pending.clear();
+
+        const auto& slots = table.lengthSlots();
+        for (size_t slot = 0; slot < slots.size(); slot++) {
+            const size_t L = slots[slot].length;
+            uint64_t& h = rolling[slot];
+            for (size_t pos = base; pos < buffer.size(); pos++) {
+                const uint64_t seen = consumed + (pos - base) + 1;   // bytes seen through pos
+                if (seen < L) continue;
+                if (seen == L) {
+                    h = hasher.hash(buf + pos + 1 - L, L);
+                } else {
+                    h = hasher.roll(h, buf[pos - L], buf[pos], slots[slot].out_power);
+                }
+                const std::vector<size_t>* candidates = table.candidates(slot, h);
+                if (!candidates) continue;
+                for (size_t id : *candidates) {
+                    if (hasher.getByteMap().equal(buf + pos + 1 - L, patterns[id].data(), L)) {
+                        pending.emplace_back(seen - L, id);
+                    }
+                }
+            }
+        }
+
+        // Report in stream order within the chunk
+        std::sort(pending.begin(), pending.end());
+        for (const auto& [offset, id] : pending) {
+            found[id] = true;
+            if (on_match) on_match(id, offset);
+        }
+
+        // The last max_len - 1 bytes start windows that end in the next chunk, and one more
+        // byte is the one each full-length hash drops on its next roll
+        consumed += len;
+        const size_t keep = std::min(buffer.size(), max_len);
+        buffer.erase(0, buffer.size() - keep);
+    }
+
+    void feed(const std::string& chunk) { feed(chunk.data(), chunk.size()); }
+
+    // Pull chunks from read(buffer, capacity) until it returns 0
+    void consume(const std::function<size_t(char*, size_t)>& read, size_t chunk_size = 1 << 20) {
+        std::vector<char> chunk(std::max<size_t>(chunk_size, 1));
+        while (size_t got = read(chunk.data(), chunk.size())) feed(chunk.data(), got);
+    }
+
+    void consume(std::istream& in, size_t chunk_size = 1 << 20) {
+        consume([&in](char* out, size_t capacity) {
+            in.read(out, static_cast<std::streamsize>(capacity));
+            return static_cast<size_t>(in.gcount());
+        }, chunk_size);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Read from a file descriptor until EOF; returns false on a read error
+    bool consumeFd(int fd, size_t chunk_size = 1 << 20) {
+        bool ok = true;
+        consume([fd, &ok](char* out, size_t capacity) -> size_t {
+            while (true) {
+                ssize_t got = ::read(fd, out, capacity);
+                if (got >= 0) return static_cast<size_t>(got);
+                if (errno != EINTR) {
+                    ok = false;
+                    return 0;
+                }
+            }
+        }, chunk_size);
+        return ok;
+    }
+#endif
+
+    // Patterns seen so far, in input order
+    std::vector<std::string> foundPatterns() const {
+        std::vector<std::string> result;
+        for (size_t id = 0; id < patterns.size(); id++) {
+            if (found[id]) result.push_back(patterns[id]);
+        }
+        return result;
+    }
+
+    uint64_t bytesConsumed() const { return consumed; }
+
+private:
+    std::vector<std::string> patterns;
+    MatchCallback on_match;
+    RollingHasher hasher;
+    PatternHashTable table;
+    std::vector<uint64_t> rolling;             // per length slot: hash of the last `length` bytes
+    std::vector<bool> found;
+    std::vector<std::pair<uint64_t, size_t>> pending;
+    std::string buffer;                        // tail of the previous chunks + current chunk
+    uint64_t consumed = 0;
+    size_t max_len = 0;
+};
+
+// On-disk layout of a serialized per-length hash index (RollingHashSet::saveIndex)
+//   header | bucket directory sorted by length | per bucket: keys, control bytes | text
+// Each bucket is a FlatHashSet written slot for slot, so a mapped file is probed in place.
+// All integers are in the writer's byte order, which byte_order records.
+struct SerializedIndexHeader {
+    static constexpr char MAGIC[8] = {'R', 'H', 'S', 'I', 'N', 'D', 'E', 'X'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t base;
+    uint64_t modulus;
+    uint64_t bucket_count;
+    uint64_t text_offset;         // 0 when the indexed text is not stored
+    uint64_t text_length;
+    uint64_t reserved;
+};
+
+struct SerializedIndexBucket {
+    uint64_t length;              // window length
+    uint64_t capacity;            // slots; a power of two multiple of FlatHashSet::GROUP_SIZE
+    uint64_t count;               // entries
+    uint64_t keys_offset;         // capacity uint64_t keys, 8-byte aligned
+    uint64_t ctrl_offset;         // capacity control bytes
+};
+
+static_assert(sizeof(SerializedIndexHeader) == 64, "header layout is part of the file format");
+static_assert(sizeof(SerializedIndexBucket) == 40, "bucket layout is part of the file format");
+
+#if defined(__unix__) || defined(__APPLE__)
+// Read-only memory map of a whole file, advised for sequential access by default
+class MappedFile {
+public:
+    enum class Access { Sequential, Random };
+
+    explicit MappedFile(const std::string& path, Access access = Access::Sequential) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("MappedFile: cannot open " + path + ": " + std::strerror(errno));
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            int error = errno;
+            ::close(fd);
+            throw std::runtime_error("MappedFile: cannot stat " + path + ": " + std::strerror(error));
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                int error = errno;
+                ::close(fd);
+                throw std::runtime_error("MappedFile: cannot map " + path + ": " + std::strerror(error));
+            }
+            data = static_cast<const char*>(mapped);
+            ::madvise(mapped, length, access == Access::Random ? MADV_RANDOM : MADV_SEQUENTIAL);
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other) noexcept : data(other.data), length(other.length) {
+        other.data = nullptr;
+        other.length = 0;
+    }
+
+    ~MappedFile() {
+        if (data) ::munmap(const_cast<char*>(data), length);
+    }
+
+    std::string_view view() const { return std::string_view(data, length); }
+
+private:
+    const char* data = nullptr;
+    size_t length = 0;
+};
+
+// Read-only per-length hash index served straight from a file written by saveIndex
+// Opening maps the file and checks the header and bucket bounds; nothing is copied or
+// rebuilt, so the first query can run immediately.
+class MappedSubstringIndex {
+public:
+    explicit MappedSubstringIndex(const std::string& path) : file(path, MappedFile::Access::Random) {
+        const std::string_view bytes = file.view();
+        auto fail = [&path](const std::string& why) {
+            throw std::runtime_error("MappedSubstringIndex: " + path + ": " + why);
+        };
+        if (bytes.size() < sizeof(SerializedIndexHeader)) fail("too short for a header");
+        header = reinterpret_cast<const SerializedIndexHeader*>(bytes.data());
+        if (std::memcmp(header->magic, SerializedIndexHeader::MAGIC, sizeof(header->magic)) != 0) {
+            fail("not a serialized index");
+        }
+        if (header->byte_order != SerializedIndexHeader::BYTE_ORDER_MARK) fail("written with another byte order");
+        if (header->version != SerializedIndexHeader::VERSION) {
+            fail("unsupported version " + std::to_string(header->version));
+        }
+        hasher = RollingHasher(header->base, header->modulus);
+
+        auto inBounds = [&bytes](uint64_t offset, uint64_t size) {
+            return offset <= bytes.size() && size <= bytes.size() - offset;
+        };
+        const uint64_t directory_bytes = header->bucket_count * sizeof(SerializedIndexBucket);
+        if (header->bucket_count > bytes.size() / sizeof(SerializedIndexBucket) ||
+            !inBounds(sizeof(SerializedIndexHeader), directory_bytes)) {
+            fail("bucket directory out of bounds");
+        }
+        buckets = reinterpret_cast<const SerializedIndexBucket*>(bytes.data() + sizeof(SerializedIndexHeader));
+        for (uint64_t b = 0; b < header->bucket_count; b++) {
+            const SerializedIndexBucket& bucket = buckets[b];
+            const bool power_of_two = (bucket.capacity & (bucket.capacity - 1)) == 0;
+            if (bucket.capacity % FlatHashSet::GROUP_SIZE != 0 || !power_of_two || bucket.count > bucket.capacity ||
+                bucket.keys_offset % alignof(uint64_t) != 0 ||
+                bucket.capacity > bytes.size() / sizeof(uint64_t) ||
+                !inBounds(bucket.keys_offset, bucket.capacity * sizeof(uint64_t)) ||
+                !inBounds(bucket.ctrl_offset, bucket.capacity) ||
+                (b > 0 && buckets[b - 1].length >= bucket.length)) {
+                fail("bucket " + std::to_string(b) + " is malformed");
+            }
+        }
+        if (header->text_offset != 0 && !inBounds(header->text_offset, header->text_length)) {
+            fail("text out of bounds");
+        }
+    }
+
+    const RollingHasher& getHasher() const { return hasher; }
+    size_t bucketCount() const { return static_cast<size_t>(header->bucket_count); }
+    bool hasText() const { return header->text_offset != 0; }
+
+    // Indexed text if it was stored, otherwise empty
+    std::string_view text() const {
+        if (!hasText()) return {};
+        return file.view().substr(header->text_offset, header->text_length);
+    }
+
+    bool hasLength(size_t length) const { return bucketFor(length) != nullptr; }
+
+    // Whether some window of the given length hashed to h
+    bool contains(size_t length, uint64_t h) const {
+        const SerializedIndexBucket* bucket = bucketFor(length);
+        if (!bucket || bucket->count == 0) return false;
+        const char* base = file.view().data();
+        return FlatHashSet::findIn(reinterpret_cast<const int8_t*>(base + bucket->ctrl_offset),
+                                   reinterpret_cast<const uint64_t*>(base + bucket->keys_offset),
+                                   static_cast<size_t>(bucket->capacity), h) != FlatHashSet::NPOS;
+    }
+
+    std::vector<size_t> lengths() const {
+        std::vector<size_t> result;
+        for (uint64_t b = 0; b < header->bucket_count; b++) result.push_back(static_cast<size_t>(buckets[b].length));
+        return result;
+    }
+
+private:
+    MappedFile file;
+    const SerializedIndexHeader* header = nullptr;
+    const SerializedIndexBucket* buckets = nullptr;
+    RollingHasher hasher;
+
+    const SerializedIndexBucket* bucketFor(size_t length) const {
+        const SerializedIndexBucket* end = buckets + header->bucket_count;
+        const SerializedIndexBucket* it = std::lower_bound(
+            buckets, end, length, [](const SerializedIndexBucket& b, size_t len) { return b.length < len; });
+        return it != end && it->length == length ? it : nullptr;
+    }
+};
+#endif
+
+// Suffix array of a byte string, built in O(n) by induced sorting (SA-IS)
+// Suffixes are ordered by unsigned byte, a proper prefix first, after applying the byte
+// map. The mapped text and the array are kept, about 5 bytes per text byte, and count()
+// binary-searches the array in O(|p| log n); FmIndex answers the same queries in O(|p|)
+// and drops the array.
+class SuffixArray {
+public:
+    static constexpr size_t MAX_LENGTH = static_cast<size_t>(std::numeric_limits<int32_t>::max() - 1);
+
+    SuffixArray() = default;
+    explicit SuffixArray(std::string_view text, const ByteMap& map = {}) { build(text, map); }
+
+    void build(std::string_view text, const ByteMap& map = {}) {
+        if (text.size() > MAX_LENGTH) throw std::length_error("SuffixArray: text longer than 2^31 - 2 bytes");
+        byte_map = map;
+        mapped_text.resize(text.size());
+        std::vector<int32_t> symbols(text.size());
+        for (size_t i = 0; i < text.size(); i++) {
+            const unsigned char c = map(text[i]);
+            mapped_text[i] = static_cast<char>(c);
+            symbols[i] = c;
+        }
+        suffixes = sortSuffixes(symbols, 255);
+    }
+
+    // Start offsets of all suffixes of s in sorted order; symbols are in [0, upper]
+    static std::vector<int32_t> sortSuffixes(const std::vector<int32_t>& s, int32_t upper) {
+        const int32_t n = static_cast<int32_t>(s.size());
+        if (n == 0) return {};
+        if (n == 1) return {0};
+        if (n == 2) return s[0] < s[1] ? std::vector<int32_t>{0, 1} : std::vector<int32_t>{1, 0};
+
+        // S-type suffixes are smaller than the suffix after them, L-type ones larger
+        std::vector<int32_t> sa(n);
+        std::vector<uint8_t> is_s(n, 0);
+        for (int32_t i = n - 2; i >= 0; i--) is_s[i] = s[i] == s[i + 1] ? is_s[i + 1] : s[i] < s[i + 1];
+
+        // Bucket of each symbol: L-type suffixes fill it from sum_l, S-type ones from sum_s
+        std::vector<int32_t> sum_l(upper + 1), sum_s(upper + 1);
+        for (int32_t i = 0; i < n; i++) {
+            if (!is_s[i]) sum_s[s[i]]++;
+            else sum_l[s[i] + 1]++;
+        }
+        for (int32_t c = 0; c <= upper; c++) {
+            sum_s[c] += sum_l[c];
+            if (c < upper) sum_l[c + 1] += sum_s[c];
+        }
+
+        // Place the LMS suffixes, then induce the L-type order left to right and the S-type
+        // order right to left
+        std::vector<int32_t> cursor(upper + 1);
+        auto induce = [&](const std::vector<int32_t>& lms) {
+            std::fill(sa.begin(), sa.end(), -1);
+            std::copy(sum_s.begin(), sum_s.end(), cursor.begin());
+            for (int32_t d : lms) {
+                if (d != n) sa[cursor[s[d]]++] = d;
+            }
+            std::copy(sum_l.begin(), sum_l.end(), cursor.begin());
+            sa[cursor[s[n - 1]]++] = n - 1;
+            for (int32_t i = 0; i < n; i++) {
+                const int32_t v = sa[i];
+                if (v >= 1 && !is_s[v - 1]) sa[cursor[s[v - 1]]++] = v - 1;
+            }
+            std::copy(sum_l.begin(), sum_l.end(), cursor.begin());
+            for (int32_t i = n - 1; i >= 0; i--) {
+                const int32_t v = sa[i];
+                if (v >= 1 && is_s[v - 1]) sa[--cursor[s[v - 1] + 1]] = v - 1;
+            }
+        };
+
+        std::vector<int32_t> lms_index(n + 1, -1);
+        std::vector<int32_t> lms;
+        for (int32_t i = 1; i < n; i++) {
+            if (!is_s[i - 1] && is_s[i]) {
+                lms_index[i] = static_cast<int32_t>(lms.size());
+                lms.push_back(i);
+            }
+        }
+        const int32_t m = static_cast<int32_t>(lms.size());
+        induce(lms);
+        if (m == 0) return sa;
+
+        // Name the LMS substrings in induced order, sort the reduced string recursively and
+        // induce once more from the exact LMS order
+        std::vector<int32_t> sorted_lms;
+        sorted_lms.reserve(m);
+        for (int32_t v : sa) {
+            if (lms_index[v] != -1) sorted_lms.push_back(v);
+        }
+        std::vector<int32_t> reduced(m);
+        int32_t name = 0;
+        reduced[lms_index[sorted_lms[0]]] = 0;
+        for (int32_t i = 1; i < m; i++) {
+            int32_t l = sorted_lms[i - 1], r = sorted_lms[i];
+            const int32_t end_l = lms_index[l] + 1 < m ? lms[lms_index[l] + 1] : n;
+            const int32_t end_r = lms_index[r] + 1 < m ? lms[lms_index[r] + 1] : n;
+            bool same = end_l - l == end_r - r;
+            if (same) {
+                while (l < end_l && s[l] == s[r]) {
+                    l++;
+                    r++;
+                }
+                same = l != n && s[l] == s[r];
+            }
+            if (!same) name++;
+            reduced[lms_index[sorted_lms[i]]] = name;
+        }
+        const std::vector<int32_t> reduced_sa = sortSuffixes(reduced, name);
+        for (int32_t i = 0; i < m; i++) sorted_lms[i] = lms[reduced_sa[i]];
+        induce(sorted_lms);
+        return sa;
+    }
+
+    // Occurrences of pattern; the empty pattern occurs at all n + 1 offsets
+    size_t count(std::string_view pattern) const {
+        if (pattern.empty()) return mapped_text.size() + 1;
+        auto first = std::lower_bound(suffixes.begin(), suffixes.end(), pattern,
+                                      [this](int32_t pos, std::string_view p) { return comparePrefix(pos, p) < 0; });
+        auto last = std::upper_bound(first, suffixes.end(), pattern,
+                                     [this](std::string_view p, int32_t pos) { return comparePrefix(pos, p) > 0; });
+        return static_cast<size_t>(last - first);
+    }
+
+    bool contains(std::string_view pattern) const { return count(pattern) > 0; }
+
+    size_t textLength() const { return mapped_text.size(); }
+    const std::vector<int32_t>& getSuffixes() const { return suffixes; }
+    const ByteMap& getByteMap() const { return byte_map; }
+    size_t memoryBytes() const { return mapped_text.capacity() + suffixes.capacity() * sizeof(int32_t); }
+
+private:
+    std::string mapped_text;
+    std::vector<int32_t> suffixes;
+    ByteMap byte_map;
+
+    // Sign of the suffix at pos against pattern, looking at |pattern| bytes at most
+    int comparePrefix(int32_t pos, std::string_view pattern) const {
+        const size_t start = static_cast<size_t>(pos);
+        const size_t available = mapped_text.size() - start;
+        for (size_t j = 0; j < pattern.size(); j++) {
+            if (j == available) return -1;
+            const unsigned char a = static_cast<unsigned char>(mapped_text[start + j]);
+            const unsigned char b = byte_map(pattern[j]);
+            if (a != b) return a < b ? -1 : 1;
+        }
+        return 0;
+    }
+};
+
+// FM-index: existence and occurrence counts of patterns of any length in O(|p|)
+// Built from the SA-IS suffix array, which is dropped once the Burrows-Wheeler transform
+// (BWT) is taken; the text itself is not kept. Symbols are renumbered over the bytes that
+// occur. Backward search narrows the range of suffixes that start with the pattern one
+// byte at a time, with two rank queries per byte:
+//   Dense       blocks of 64 BWT bytes, each followed by the count of every symbol
+//               before it; a rank reads one block: a count plus at most 63 byte compares.
+//   Compressed  the BWT as a wavelet matrix: ceil(log2 sigma) bit levels, each with a
+//               25% rank directory interleaved with its bits; a rank is one popcount
+//               per level.
+class FmIndex {
+public:
+    enum class Layout { Dense, Compressed };
+
+    FmIndex() = default;
+    explicit FmIndex(std::string_view text, Layout layout = Layout::Dense, const ByteMap& map = {}) {
+        build(text, layout, map);
+    }
+
+    void build(std::string_view text, Layout layout = Layout::Dense, const ByteMap& map = {}) {
+        if (text.size() > SuffixArray::MAX_LENGTH) throw std::length_error("FmIndex: text longer than 2^31 - 2 bytes");
+        this->layout = layout;
+        byte_map = map;
+        text_length = text.size();
+
+        // Renumber the bytes that occur as 0..sigma-1
+        std::array<size_t, 256> histogram{};
+        for (char c : text) histogram[map(c)]++;
+        code.fill(-1);
+        sigma = 0;
+        for (unsigned c = 0; c < 256; c++) {
+            if (histogram[c]) code[c] = static_cast<int16_t>(sigma++);
+        }
+        std::vector<int32_t> symbols(text.size());
+        for (size_t i = 0; i < text.size(); i++) symbols[i] = code[map(text[i])];
+
+        // Row 0 is the empty suffix (the sentinel sorts first); first[c] is the first row
+        // of suffixes starting with c
+        first.assign(sigma + 1, 1);
+        for (unsigned c = 0; c < 256; c++) {
+            if (code[c] >= 0) first[code[c] + 1] = first[code[c]] + histogram[c];
+        }
+
+        // BWT row r is the symbol before suffix r; the row of the whole text has none and
+        // stores symbol 0 as a placeholder that rank() discounts
+        const size_t rows = text_length + 1;
+        std::vector<uint8_t> bwt(rows);
+        {
+            const std::vector<int32_t> sa = SuffixArray::sortSuffixes(symbols, std::max<int32_t>(sigma, 1) - 1);
+            bwt[0] = text_length ? static_cast<uint8_t>(symbols[text_length - 1]) : 0;
+            sentinel_row = text_length ? rows : 0;
+            for (size_t r = 1; r < rows; r++) {
+                const int32_t pos = sa[r - 1];
+                if (pos == 0) {
+                    sentinel_row = r;
+                    bwt[r] = 0;
+                } else {
+                    bwt[r] = static_cast<uint8_t>(symbols[pos - 1]);
+                }
+            }
+        }
+        symbols = {};
+
+        dense_blocks.clear();
+        levels.clear();
+        if (layout == Layout::Dense) buildDense(bwt);
+        else buildWaveletMatrix(std::move(bwt));
+    }
+
+    // Occurrences of pattern; the empty pattern occurs at all n + 1 offsets
+    size_t count(std::string_view pattern) const {
+        size_t lo = 0;
+        size_t hi = text_length + 1;
+        for (size_t j = pattern.size(); j-- > 0 && lo < hi;) {
+            const int16_t c = code[byte_map(pattern[j])];
+            if (c < 0) return 0;
+            lo = first[c] + rank(static_cast<size_t>(c), lo);
+            hi = first[c] + rank(static_cast<size_t>(c), hi);
+        }
+        return hi > lo ? hi - lo : 0;
+    }
+
+    bool contains(std::string_view pattern) const { return count(pattern) > 0; }
+
+    size_t textLength() const { return text_length; }
+    size_t alphabetSize() const { return sigma; }
+    Layout getLayout() const { return layout; }
+    const ByteMap& getByteMap() const { return byte_map; }
+
+    size_t memoryBytes() const {
+        size_t bytes = dense_blocks.capacity() * sizeof(uint32_t) + first.capacity() * sizeof(size_t);
+        for (const Level& level : levels) {
+            bytes += level.blocks.capacity() * sizeof(uint64_t);
+        }
+        return bytes;
+    }
+
+private:
+    static constexpr size_t BLOCK_ROWS = 64;
+    static constexpr size_t BLOCK_BYTE_WORDS = BLOCK_ROWS / sizeof(uint32_t);
+    static constexpr size_t WORDS_PER_BLOCK = 4;
+    static constexpr size_t BLOCK_BITS = WORDS_PER_BLOCK * 64;
+    static constexpr size_t BLOCK_STRIDE = WORDS_PER_BLOCK + 1;
+
+    // One bit level of the wavelet matrix in 256-bit blocks, each led by a directory word:
+    // ones before the block in the low 32 bits, then ones before words 1-3 of the block
+    // in one byte each
+    struct Level {
+        std::vector<uint64_t> blocks;
+        size_t zeros = 0;
+
+        void set(size_t i) {
+            blocks[i / BLOCK_BITS * BLOCK_STRIDE + 1 + i / 64 % WORDS_PER_BLOCK] |= uint64_t{1} << (i % 64);
+        }
+
+        size_t rank1(size_t i) const {
+            const uint64_t* block = blocks.data() + i / BLOCK_BITS * BLOCK_STRIDE;
+            const size_t word = i / 64 % WORDS_PER_BLOCK;
+            size_t ones = static_cast<uint32_t>(block[0]);
+            if (word) ones += static_cast<size_t>((block[0] >> (24 + 8 * word)) & 0xff);
+            return ones + static_cast<size_t>(__builtin_popcountll(block[1 + word] & ((uint64_t{1} << (i % 64)) - 1)));
+        }
+    };
+
+    Layout layout = Layout::Dense;
+    ByteMap byte_map;
+    size_t text_length = 0;
+    size_t sigma = 0;
+    size_t sentinel_row = 0;
+    std::array<int16_t, 256> code{};
+    std::vector<size_t> first;
+
+    std::vector<uint32_t> dense_blocks;  // per BLOCK_ROWS rows: their BWT bytes, then sigma counts
+
+    std::vector<Level> levels;           // most significant bit first
+    std::vector<size_t> level_start;     // where each symbol's run begins after the last level
+
+    // Rows before i whose BWT symbol is c
+    size_t rank(size_t c, size_t i) const {
+        size_t r = layout == Layout::Dense ? denseRank(c, i) : waveletRank(c, i);
+        if (c == 0 && sentinel_row < i) r--;
+        return r;
+    }
+
+    size_t denseRank(size_t c, size_t i) const {
+        const uint32_t* block = dense_blocks.data() + i / BLOCK_ROWS * (BLOCK_BYTE_WORDS + sigma);
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(block);
+        const size_t before = i % BLOCK_ROWS;
+        size_t r = block[BLOCK_BYTE_WORDS + c];
+#if defined(__SSE2__)
+        const __m128i symbol = _mm_set1_epi8(static_cast<char>(c));
+        uint64_t mask = 0;
+        for (size_t q = 0; q < BLOCK_ROWS / 16; q++) {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + 16 * q));
+            mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, symbol))))
+                    << (16 * q);
+        }
+        r += static_cast<size_t>(__builtin_popcountll(mask & ((uint64_t{1} << before) - 1)));
+#else
+        for (size_t k = 0; k < before; k++) r += bytes[k] == c;
+#endif
+        return r;
+    }
+
+    size_t waveletRank(size_t c, size_t i) const {
+        for (size_t l = 0; l < levels.size(); l++) {
+            const Level& level = levels[l];
+            if ((c >> (levels.size() - 1 - l)) & 1) i = level.zeros + level.rank1(i);
+            else i -= level.rank1(i);
+        }
+        return i - level_start[c];
+    }
+
+    // One block more than rows need, so rank(c, rows) has counts to read
+    void buildDense(const std::vector<uint8_t>& bwt) {
+        const size_t stride = BLOCK_BYTE_WORDS + sigma;
+        dense_blocks.assign((bwt.size() / BLOCK_ROWS + 1) * stride, 0);
+        std::vector<uint32_t> running(sigma, 0);
+        for (size_t start = 0; start <= bwt.size(); start += BLOCK_ROWS) {
+            uint32_t* block = dense_blocks.data() + start / BLOCK_ROWS * stride;
+            std::copy(running.begin(), running.end(), block + BLOCK_BYTE_WORDS);
+            const size_t rows = std::min(BLOCK_ROWS, bwt.size() - start);
+            std::memcpy(block, bwt.data() + start, rows);
+            if (sigma) for (size_t r = start; r < start + rows; r++) running[bwt[r]]++;
+        }
+    }
+
+    // Each level splits the sequence stably by one bit, zeros first, and the next level
+    // sees the reordered sequence
+    void buildWaveletMatrix(std::vector<uint8_t> bwt) {
+        const size_t rows = bwt.size();
+        size_t bits = 1;
+        while ((size_t{1} << bits) < sigma) bits++;
+        levels.assign(bits, Level{});
+        std::vector<uint8_t> next(rows);
+        for (size_t l = 0; l < bits; l++) {
+            const unsigned shift = static_cast<unsigned>(bits - 1 - l);
+            Level& level = levels[l];
+            level.blocks.assign((rows / BLOCK_BITS + 1) * BLOCK_STRIDE, 0);
+            for (size_t r = 0; r < rows; r++) {
+                if ((bwt[r] >> shift) & 1) level.set(r);
+            }
+            size_t ones = 0;
+            for (size_t b = 0; b < level.blocks.size(); b += BLOCK_STRIDE) {
+                uint64_t directory = ones;
+                for (size_t w = 0; w < WORDS_PER_BLOCK; w++) {
+                    const size_t in_block = ones - static_cast<size_t>(static_cast<uint32_t>(directory));
+                    if (w) directory |= static_cast<uint64_t>(in_block) << (24 + 8 * w);
+                    ones += static_cast<size_t>(__builtin_popcountll(level.blocks[b + 1 + w]));
+                }
+                level.blocks[b] = directory;
+            }
+            level.zeros = rows - ones;
+            size_t zero_at = 0, one_at = level.zeros;
+            for (size_t r = 0; r < rows; r++) {
+                if ((bwt[r] >> shift) & 1) next[one_at++] = bwt[r];
+                else next[zero_at++] = bwt[r];
+            }
+            bwt.swap(next);
+        }
+        // After the last level equal symbols are contiguous
+        level_start.assign(std::max<size_t>(sigma, 1), 0);
+        for (size_t r = rows; r-- > 0;) level_start[bwt[r]] = r;
+    }
+};
+
+// Search strategies available behind RollingHashSet::search
+enum class SearchStrategy {
+    Auto,
+    BruteForce,
+    RollingHash,
+    ReverseHash,
+    AhoCorasick,
+    FmIndex
+};
+
+inline const char* strategyName(SearchStrategy strategy) {
+    switch (strategy) {
+        case SearchStrategy::Auto: return "auto";
+        case SearchStrategy::BruteForce: return "brute force";
+        case SearchStrategy::RollingHash: return "rolling hash";
+        case SearchStrategy::ReverseHash: return "reverse hash";
+        case SearchStrategy::AhoCorasick: return "aho-corasick";
+        case SearchStrategy::FmIndex: return "fm-index";
+    }
+    return "unknown";
+}
+
+// Shape of one search call, as seen by the strategy cost model
+struct InputShape {
+    size_t text_length = 0;
+    size_t pattern_count = 0;
+    size_t distinct_lengths = 0;
+    size_t total_pattern_bytes = 0;
+    size_t hashed_windows = 0;   // sum over distinct lengths of (text_length - len + 1)
+};
+
+// Linear cost model in nanoseconds per unit of work
+// Defaults were measured on random lowercase text; calibrateStrategyCosts() refits them.
+struct StrategyCostModel {
+    double brute_force_ns_per_text_byte_per_pattern = 0.07;
+    double rolling_hash_ns_per_window = 25.0;
+    double rolling_hash_ns_per_pattern = 100.0;
+    double reverse_hash_ns_per_window = 8.0;
+    double reverse_hash_ns_per_pattern = 200.0;
+    double aho_corasick_ns_per_text_byte = 8.0;
+    double aho_corasick_ns_per_pattern_byte = 170.0;
+    double fm_index_ns_per_text_byte = 80.0;     // SA-IS and BWT, paid once per call
+    double fm_index_ns_per_pattern_byte = 20.0;
+
+    double estimate(SearchStrategy strategy, const InputShape& shape) const {
+        switch (strategy) {
+            case SearchStrategy::BruteForce:
+                return brute_force_ns_per_text_byte_per_pattern *
+                       static_cast<double>(shape.text_length) * static_cast<double>(shape.pattern_count);
+            case SearchStrategy::RollingHash:
+                return rolling_hash_ns_per_window * static_cast<double>(shape.hashed_windows) +
+                       rolling_hash_ns_per_pattern * static_cast<double>(shape.pattern_count);
+            case SearchStrategy::ReverseHash:
+                return reverse_hash_ns_per_window * static_cast<double>(shape.hashed_windows) +
+                       reverse_hash_ns_per_pattern * static_cast<double>(shape.pattern_count);
+            case SearchStrategy::AhoCorasick:
+                return aho_corasick_ns_per_text_byte * static_cast<double>(shape.text_length) +
+                       aho_corasick_ns_per_pattern_byte * static_cast<double>(shape.total_pattern_bytes);
+            case SearchStrategy::FmIndex:
+                return fm_index_ns_per_text_byte * static_cast<double>(shape.text_length) +
+                       fm_index_ns_per_pattern_byte * static_cast<double>(shape.total_pattern_bytes);
+            case SearchStrategy::Auto:
+                break;
+        }
+        return 0.0;
+    }
+};
+
+// Match bits for a batch of records: bit p of record r is set when pattern p occurs in it
+// Records are stored back to back in whole 64-bit words.
+class RecordMatches {
+public:
+    RecordMatches() = default;
+
+    RecordMatches(size_t records, size_t patterns)
+        : record_count(records), pattern_count(patterns), words_per_record((patterns + 63) / 64),
+          bits(records * words_per_record, 0) {}
+
+    size_t recordCount() const { return record_count; }
+    size_t patternCount() const { return pattern_count; }
+    size_t wordsPerRecord() const { return words_per_record; }
+
+    bool test(size_t record, size_t pattern) const {
+        return (bits[record * words_per_record + pattern / 64] >> (pattern % 64)) & 1;
+    }
+
+    void set(size_t record, size_t pattern) {
+        bits[record * words_per_record + pattern / 64] |= uint64_t{1} << (pattern % 64);
+    }
+
+    // wordsPerRecord() words of record's bits
+    const uint64_t* recordBits(size_t record) const { return bits.data() + record * words_per_record; }
+
+    bool any(size_t record) const {
+        const uint64_t* words = recordBits(record);
+        return std::any_of(words, words + words_per_record, [](uint64_t w) { return w != 0; });
+    }
+
+    size_t count(size_t record) const {
+        size_t total = 0;
+        const uint64_t* words = recordBits(record);
+        for (size_t w = 0; w < words_per_record; w++) total += static_cast<size_t>(__builtin_popcountll(words[w]));
+        return total;
+    }
+
+    // Ids of the patterns found in record, ascending
+    std::vector<size_t> matches(size_t record) const {
+        std::vector<size_t> ids;
+        const uint64_t* words = recordBits(record);
+        for (size_t w = 0; w < words_per_record; w++) {
+            for (uint64_t m = words[w]; m; m &= m - 1) {
+                ids.push_back(w * 64 + static_cast<size_t>(__builtin_ctzll(m)));
+            }
+        }
+        return ids;
+    }
+
+private:
+    size_t record_count = 0;
+    size_t pattern_count = 0;
+    size_t words_per_record = 0;
+    std::vector<uint64_t> bits;
+};
+
+// A fixed pattern set hashed once, for searching many short records
+// Patterns are hashed per length up front, so a search only rolls over the records and
+// confirms hits with memcmp. Each length also gets a small bitmap of its pattern hashes
+// that screens windows before the hash table is probed. search() takes records in batches
+// of about batch_bytes and walks each batch once per pattern length, so the batch stays
+// in L1 between lengths. When the cost model says a SIMD scan per pattern is cheaper than
+// rolling one hash per length (few patterns over many lengths), records are scanned instead.
+// Empty patterns match every record, as in bruteForceSearch.
+class CompiledPatternSet {
+public:
+    static constexpr size_t DEFAULT_BATCH_BYTES = 16 << 10;
+
+    explicit CompiledPatternSet(const std::vector<std::string>& patterns,
+                                const RollingHasher& hasher = RollingHasher(),
+                                const StrategyCostModel& costs = {})
+        : patterns(patterns), hasher(hasher), table(toPatternViews(this->patterns), hasher) {
+        for (size_t id = 0; id < this->patterns.size(); id++) {
+            if (this->patterns[id].empty()) empty_ids.push_back(id);
+        }
+        const size_t nonempty = this->patterns.size() - empty_ids.size();
+        const auto& slots = table.lengthSlots();
+        // Both strategies are linear in record bytes, so the choice does not depend on the records.
+        // A mapped scan derives byte classes per call, which short records cannot amortize.
+        scan_records = hasher.getByteMap().isIdentity() &&
+                       costs.brute_force_ns_per_text_byte_per_pattern * static_cast<double>(nonempty) <
+                       costs.reverse_hash_ns_per_window * static_cast<double>(slots.size());
+
+        for (const auto& slot : slots) {
+            // About 16 bits per hash, at least one 64-bit word
+            size_t bits = 64;
+            while (bits < slot.groups.size() * 16) bits *= 2;
+            filter_shift.push_back(static_cast<unsigned>(64 - __builtin_ctzll(bits)));
+            filter_offset.push_back(filter_words.size());
+            filter_words.resize(filter_words.size() + bits / 64, 0);
+            slot.groups.forEach([&](uint64_t h, size_t) {
+                const uint64_t bit = filterBit(filter_shift.back(), h);
+                filter_words[filter_offset.back() + bit / 64] |= uint64_t{1} << (bit % 64);
+            });
+        }
+    }
+
+    size_t size() const { return patterns.size(); }
+    const std::vector<std::string>& getPatterns() const { return patterns; }
+    // True when records are scanned per pattern rather than rolled per length
+    bool scansRecords() const { return scan_records; }
+
+    void setBatchBytes(size_t bytes) { batch_bytes = std::max<size_t>(bytes, 1); }
+    size_t getBatchBytes() const { return batch_bytes; }
+
+    // Match bits for every record; records are split across `threads` workers
+    RecordMatches search(const PatternViews& records, size_t threads = 1) const {
+        RecordMatches result(records.size(), patterns.size());
+        const size_t workers = std::max<size_t>(std::min(threads, records.size()), 1);
+        parallelFor(workers, [&](size_t w) {
+            const size_t first = records.size() * w / workers;
+            const size_t last = records.size() * (w + 1) / workers;
+            for (size_t begin = first; begin < last;) {
+                size_t end = begin;
+                size_t bytes = 0;
+                while (end < last && (end == begin || bytes + records[end].length() <= batch_bytes)) {
+                    bytes += records[end++].length();
+                }
+                for (size_t r = begin; r < end; r++) {
+                    for (size_t id : empty_ids) result.set(r, id);
+                }
+                if (scan_records) scanBatch(records, begin, end, result);
+                else searchBatch(records, begin, end, result);
+                begin = end;
+            }
+        });
+        return result;
+    }
+
+    RecordMatches search(const std::vector<std::string>& records, size_t threads = 1) const {
+        return search(toPatternViews(records), threads);
+    }
+
+    // Ids of the patterns found in a single record, ascending
+    std::vector<size_t> searchIndices(std::string_view record) const {
+        RecordMatches matches = search(PatternViews{record});
+        return matches.matches(0);
+    }
+
+    std::vector<std::string> search(std::string_view record) const {
+        return selectPatterns(patterns, searchIndices(record));
+    }
+
+private:
+    std::vector<std::string> patterns;
+    RollingHasher hasher;
+    PatternHashTable table;
+    std::vector<size_t> empty_ids;
+    bool scan_records = false;
+    size_t batch_bytes = DEFAULT_BATCH_BYTES;
+    // Per length slot: a bitmap of filter_words starting at filter_offset, indexed by the
+    // top bits of the multiplied hash
+    std::vector<uint64_t> filter_words;
+    std::vector<size_t> filter_offset;
+    std::vector<unsigned> filter_shift;
+
+    static uint64_t filterBit(unsigned shift, uint64_t h) { return (h * 0x9e3779b97f4a7c15ULL) >> shift; }
+
+    void searchBatch(const PatternViews& records, size_t begin, size_t end, RecordMatches& result) const {
+        const auto& slots = table.lengthSlots();
+        for (size_t slot = 0; slot < slots.size(); slot++) {
+            const size_t L = slots[slot].length;
+            const uint64_t out_power = slots[slot].out_power;
+            const uint64_t* filter = filter_words.data() + filter_offset[slot];
+            const ByteMap& byte_map = hasher.getByteMap();
+            const unsigned shift = filter_shift[slot];
+            for (size_t r = begin; r < end; r++) {
+                const std::string_view record = records[r];
+                if (record.length() < L) continue;
+                const char* data = record.data();
+                uint64_t h = hasher.hash(data, L);
+                for (size_t i = 0;; i++) {
+                    const uint64_t bit = filterBit(shift, h);
+                    if ((filter[bit / 64] >> (bit % 64)) & 1) {
+                        if (const std::vector<size_t>* candidates = table.candidates(slot, h)) {
+                            for (size_t id : *candidates) {
+                                if (!result.test(r, id) && byte_map.equal(data + i, patterns[id].data(), L)) {
+                                    result.set(r, id);
+                                }
+                            }
+                        }
+                    }
+                    if (i + L >= record.length()) break;
+                    h = hasher.roll(h, data[i], data[i + L], out_power);
+                }
+            }
+        }
+    }
+
+    void scanBatch(const PatternViews& records, size_t begin, size_t end, RecordMatches& result) const {
+        for (size_t id = 0; id < patterns.size(); id++) {
+            if (patterns[id].empty()) continue;
+            for (size_t r = begin; r < end; r++) {
+                if (simd_find::find(records[r], patterns[id], hasher.getByteMap()) != std::string_view::npos) {
+                    result.set(r, id);
+                }
+            }
+        }
+    }
+};
+
+// Compile-time helpers for StaticPatternSet
+namespace static_patterns {
+
+// Polynomial hash modulo 2^64: one multiply on the rolling chain and no reduction.
+// It is weaker than Mersenne-61, but every hit is confirmed with memcmp anyway.
+constexpr uint64_t BASE = RollingHasher::DEFAULT_BASE;
+
+constexpr uint64_t hash(std::string_view str) {
+    uint64_t h = 0;
+    for (char c : str) h = h * BASE + static_cast<unsigned char>(c);
+    return h;
+}
+
+// BASE^k
+constexpr uint64_t power(size_t k) {
+    uint64_t result = 1;
+    while (k-- > 0) result *= BASE;
+    return result;
+}
+
+// Slide a window of length L one byte right; `out_power` is BASE^L
+constexpr uint64_t roll(uint64_t h, char out, char in, uint64_t out_power) {
+    return h * BASE + static_cast<unsigned char>(in) - static_cast<unsigned char>(out) * out_power;
+}
+
+// Distinct pattern lengths, ascending
+
+template<size_t N>
+struct LengthSet {
+    std::array<size_t, N> values{};
+    size_t count = 0;
+};
+
+template<size_t N>
+constexpr LengthSet<N> distinctLengths(const std::array<std::string_view, N>& patterns) {
+    LengthSet<N> out;
+    for (const std::string_view& p : patterns) {
+        size_t j = 0;
+        while (j < out.count && out.values[j] < p.size()) j++;
+        if (j < out.count && out.values[j] == p.size()) continue;
+        for (size_t k = out.count; k > j; k--) out.values[k] = out.values[k - 1];
+        out.values[j] = p.size();
+        out.count++;
+    }
+    return out;
+}
+
+template<size_t M, size_t N>
+constexpr std::array<size_t, M> firstLengths(const LengthSet<N>& lengths) {
+    std::array<size_t, M> out{};
+    for (size_t i = 0; i < M; i++) out[i] = lengths.values[i];
+    return out;
+}
+
+} // namespace static_patterns
+
+// A pattern set fixed at compile time, e.g. protocol keywords
+// C++17 has no string literal template arguments, so patterns are passed as arrays with
+// static storage:
+//     static constexpr char GET[] = "GET", POST[] = "POST";
+//     StaticPatternSet<GET, POST>::rollingHashSearch(request);
+// Pattern hashes, the length set and the dropped byte's power per length are constants.
+// The search rolls one hash per distinct length in a single pass and compares it against
+// each pattern of that length in an unrolled chain of compare-and-memcmp, so there is no
+// index to build at run time. Hits are confirmed with memcmp, so results equal
+// rollingHashSearch in Verified mode: ascending pattern ids.
+template<const char*... Patterns>
+class StaticPatternSet {
+public:
+    static constexpr size_t COUNT = sizeof...(Patterns);
+    static_assert(COUNT > 0, "StaticPatternSet: needs at least one pattern");
+
+    static constexpr std::array<std::string_view, COUNT> PATTERNS = {std::string_view(Patterns)...};
+    static constexpr std::array<uint64_t, COUNT> HASHES = {static_patterns::hash(Patterns)...};
+
+private:
+    static constexpr auto LENGTH_SET = static_patterns::distinctLengths(PATTERNS);
+    static_assert(LENGTH_SET.values[0] > 0, "StaticPatternSet: patterns must not be empty");
+
+public:
+    static constexpr size_t LENGTH_COUNT = LENGTH_SET.count;
+    static constexpr std::array<size_t, LENGTH_COUNT> LENGTHS =
+        static_patterns::firstLengths<LENGTH_COUNT>(LENGTH_SET);
+
+    static std::vector<std::string> patterns() {
+        return std::vector<std::string>(PATTERNS.begin(), PATTERNS.end());
+    }
+
+    static std::vector<size_t> rollingHashSearchIndices(std::string_view text) {
+        std::array<bool, COUNT> found{};
+        searchLengths(text, found, std::make_index_sequence<LENGTH_COUNT>{});
+        std::vector<size_t> result;
+        for (size_t i = 0; i < COUNT; i++) {
+            if (found[i]) result.push_back(i);
+        }
+        return result;
+    }
+
+    static std::vector<std::string> rollingHashSearch(std::string_view text) {
+        std::vector<std::string> result;
+        for (size_t i : rollingHashSearchIndices(text)) result.emplace_back(PATTERNS[i]);
+        return result;
+    }
+
+private:
+    static constexpr size_t MAX_LENGTH = LENGTHS[LENGTH_COUNT - 1];
+
+    // While every length fits, all lengths roll together in one pass so their multiply
+    // chains overlap; the last MAX_LENGTH - 1 windows of the shorter lengths finish alone
+    template<size_t... K>
+    static void searchLengths(std::string_view text, std::array<bool, COUNT>& found, std::index_sequence<K...>) {
+        const char* data = text.data();
+        size_t i = 0;
+        if (text.size() >= MAX_LENGTH) {
+            constexpr std::array<uint64_t, LENGTH_COUNT> OUT_POWERS = {static_patterns::power(LENGTHS[K])...};
+            std::array<uint64_t, LENGTH_COUNT> h = {static_patterns::hash(std::string_view(data, LENGTHS[K]))...};
+            for (;; i++) {
+                (matchLength<LENGTHS[K]>(h[K], data + i, found, std::make_index_sequence<COUNT>{}), ...);
+                if (i + MAX_LENGTH >= text.size()) break;
+                ((h[K] = static_patterns::roll(h[K], data[i], data[i + LENGTHS[K]], OUT_POWERS[K])), ...);
+            }
+            i++;
+        }
+        (searchTail<LENGTHS[K]>(text, i, found), ...);
+    }
+
+    // Windows of length L starting at or after `from`
+    template<size_t L>
+    static void searchTail(std::string_view text, size_t from, std::array<bool, COUNT>& found) {
+        if (from + L > text.size()) return;
+        constexpr uint64_t OUT_POWER = static_patterns::power(L);
+        const char* data = text.data();
+        uint64_t h = static_patterns::hash(std::string_view(data + from, L));
+        for (size_t i = from;; i++) {
+            matchLength<L>(h, data + i, found, std::make_index_sequence<COUNT>{});
+            if (i + L >= text.size()) break;
+            h = static_patterns::roll(h, data[i], data[i + L], OUT_POWER);
+        }
+    }
+
+    template<size_t L, size_t... I>
+    static void matchLength(uint64_t h, const char* window, std::array<bool, COUNT>& found, std::index_sequence<I...>) {
+        (matchAt<L, I>(h, window, found), ...);
+    }
+
+    // Expands to nothing for patterns of other lengths
+    template<size_t L, size_t I>
+    static void matchAt(uint64_t h, const char* window, std::array<bool, COUNT>& found) {
+        if constexpr (PATTERNS[I].size() == L) {
+            if (h == HASHES[I] && std::memcmp(window, PATTERNS[I].data(), L) == 0) found[I] = true;
+        }
+    }
+};
+
+// Configuration for RollingHashSet::search; a fixed strategy bypasses the cost model
+struct SearchConfig {
+    SearchStrategy strategy = SearchStrategy::Auto;
+    MatchMode match_mode = MatchMode::Fast;
+    StrategyCostModel costs;
+    size_t threads = 0;                        // 0 = std::thread::hardware_concurrency()
+    size_t min_windows_per_thread = 1 << 16;   // smaller index builds stay single-threaded
+    size_t min_probes_per_thread = 4096;       // per worker in the rolling-hash probe loop
+    size_t min_brute_force_bytes_per_thread = 1 << 22;  // text bytes x patterns per worker
+    bool use_bloom_filter = false;             // reject absent patterns before the index
+    double bloom_bits_per_key = 10.0;
+    size_t bloom_max_bytes = 1 << 20;          // keep the filter L2-sized
+    ByteMap byte_map;                          // e.g. ByteMap::asciiCaseFold() for case-insensitive search
+    IndexMemoryPolicy index_memory;            // huge pages and NUMA placement of the persistent index
+    bool prefetch_probes = true;               // probe indexes in prefetched groups; see PROBE_BATCH
+};
+
+// Counters from the most recent rollingHashSearch call
+struct SearchStats {
+    MatchMode mode = MatchMode::Fast;
+    size_t probes = 0;
+    size_t hash_hits = 0;
+    size_t verified_collisions = 0;         // hash hits whose characters did not match
+    double estimated_false_positive_rate = 0.0;  // per probe of an absent pattern
+    size_t bloom_rejects = 0;               // probes answered by the Bloom filter alone
+    size_t bloom_false_positives = 0;       // passed the filter but missed the index
+    size_t bloom_bytes = 0;
+    double bloom_estimated_false_positive_rate = 0.0;
+};
+
+// One occurrence of a pattern in the searched text
+struct Occurrence {
+    size_t pattern_id;
+    size_t offset;
+
+    bool operator==(const Occurrence& other) const {
+        return pattern_id == other.pattern_id && offset == other.offset;
+    }
+};
+
+struct OccurrenceOptions {
+    bool count_only = false;    // only fill counts, do not materialize occurrences
+    size_t max_matches = std::numeric_limits<size_t>::max();   // stop scanning after this many
+};
+
+struct OccurrenceResult {
+    std::vector<Occurrence> occurrences;   // by offset, then by pattern length
+    std::vector<size_t> counts;            // per pattern id
+    size_t total = 0;
+    bool truncated = false;                // the scan stopped at max_matches
+};
+
+// Counters kept by SearchMetrics
+enum class Metric : size_t {
+    Queries,               // public search and query calls, and QueryService requests
+    WindowsHashed,         // text windows rolled into an index or against a pattern table
+    Probes,
+    HashHits,
+    BloomRejects,
+    BloomFalsePositives,
+    VerifiedCollisions     // hash hits whose characters did not match
+};
+
+constexpr size_t METRIC_COUNT = 7;
+
+inline const char* metricName(Metric metric) {
+    switch (metric) {
+        case Metric::Queries: return "queries";
+        case Metric::WindowsHashed: return "windows_hashed";
+        case Metric::Probes: return "probes";
+        case Metric::HashHits: return "hash_hits";
+        case Metric::BloomRejects: return "bloom_rejects";
+        case Metric::BloomFalsePositives: return "bloom_false_positives";
+        case Metric::VerifiedCollisions: return "verified_collisions";
+    }
+    return "unknown";
+}
+
+// Log-linear latency buckets in the style of HdrHistogram
+// Values below 2^SUB_BITS ns get a bucket each; above that, every power of two is split
+// into 2^SUB_BITS equal buckets, so a bucket is at most 1/16 = 6.25% wide relative to
+// its value. Values of 2^MAX_EXPONENT ns (about 18 minutes) and more share the last bucket.
+struct LatencyBuckets {
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr unsigned MAX_EXPONENT = 40;
+    static constexpr size_t SUB_BUCKETS = size_t{1} << SUB_BITS;
+    static constexpr size_t COUNT = SUB_BUCKETS * (MAX_EXPONENT - SUB_BITS + 1);
+
+    static size_t indexOf(uint64_t ns) {
+        if (ns < SUB_BUCKETS) return static_cast<size_t>(ns);
+        const unsigned exponent = 63 - static_cast<unsigned>(__builtin_clzll(ns));
+        if (exponent >= MAX_EXPONENT) return COUNT - 1;
+        const size_t sub = static_cast<size_t>(ns >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return SUB_BUCKETS * (exponent - SUB_BITS + 1) + sub;
+    }
+
+    // Smallest value that lands in bucket i
+    static uint64_t lowerBound(size_t i) {
+        if (i < SUB_BUCKETS) return i;
+        const unsigned exponent = static_cast<unsigned>(i / SUB_BUCKETS) + SUB_BITS - 1;
+        return (uint64_t{1} << exponent) + (static_cast<uint64_t>(i % SUB_BUCKETS) << (exponent - SUB_BITS));
+    }
+};
+
+// Point-in-time copy of SearchMetrics, plus index gauges filled by RollingHashSet
+struct MetricsSnapshot {
+    std::array<uint64_t, METRIC_COUNT> counters{};
+    std::vector<uint64_t> latency_buckets;   // query count per LatencyBuckets index
+    uint64_t latency_count = 0;
+    uint64_t latency_sum_ns = 0;
+    uint64_t latency_max_ns = 0;
+    // Persistent index gauges; zero when the snapshot did not come from a RollingHashSet
+    uint64_t index_entries = 0;
+    uint64_t index_bytes = 0;
+    double index_load_factor = 0.0;
+
+    uint64_t get(Metric metric) const { return counters[static_cast<size_t>(metric)]; }
+
+    // Latency at quantile q in [0, 1], as the midpoint of the bucket holding it
+    double latencyQuantileNs(double q) const {
+        if (latency_count == 0) return 0.0;
+        const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * latency_count)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < latency_buckets.size(); i++) {
+            seen += latency_buckets[i];
+            if (seen >= rank) {
+                const double low = static_cast<double>(LatencyBuckets::lowerBound(i));
+                const double high = i + 1 < LatencyBuckets::COUNT
+                                  ? static_cast<double>(LatencyBuckets::lowerBound(i + 1)) : low;
+                return std::min((low + high) / 2.0, static_cast<double>(latency_max_ns));
+            }
+        }
+        return static_cast<double>(latency_max_ns);
+    }
+
+    double meanLatencyNs() const {
+        return latency_count ? static_cast<double>(latency_sum_ns) / latency_count : 0.0;
+    }
+};
+
+// Shard of SearchMetrics owned by the calling thread
+// A thread claims one of SLOTS slots on its first report and frees it when it exits, so
+// each slot has a single writer at a time. Threads beyond SLOTS share the overflow slot.
+class MetricsThreadSlot {
+public:
+    static constexpr size_t SLOTS = 32;
+    static constexpr size_t OVERFLOW_SLOT = SLOTS;
+
+    static size_t current() {
+        thread_local MetricsThreadSlot slot;
+        return slot.index;
+    }
+
+private:
+    size_t index = OVERFLOW_SLOT;
+
+    static std::atomic<uint32_t>& claimed() {
+        static std::atomic<uint32_t> bits{0};
+        return bits;
+    }
+
+    MetricsThreadSlot() {
+        uint32_t bits = claimed().load(std::memory_order_relaxed);
+        while (~bits != 0) {
+            const unsigned free_slot = static_cast<unsigned>(__builtin_ctz(~bits));
+            if (claimed().compare_exchange_weak(bits, bits | (uint32_t{1} << free_slot), std::memory_order_acquire)) {
+                index = free_slot;
+                return;
+            }
+        }
+    }
+
+    ~MetricsThreadSlot() {
+        if (index != OVERFLOW_SLOT) claimed().fetch_and(~(uint32_t{1} << index), std::memory_order_release);
+    }
+};
+
+// Always-on search telemetry: counters and a per-query latency histogram
+// Each thread updates its own cache-line-aligned shard (see MetricsThreadSlot) with a
+// relaxed load and store, so reporting costs no locked instructions and no allocation;
+// only the shared overflow shard uses atomic adds. snapshot() sums the shards; it can run
+// at any time from an exporter thread and sees each counter at some recent value.
+class SearchMetrics {
+public:
+    // Process-wide instance that RollingHashSet and QueryService report to by default
+    static SearchMetrics& global() {
+        static SearchMetrics instance;
+        return instance;
+    }
+
+    void add(Metric metric, uint64_t amount = 1) {
+        const size_t slot = MetricsThreadSlot::current();
+        bump(slot, shards[slot].counters[static_cast<size_t>(metric)], amount);
+    }
+
+    void add(const SearchStats& stats) {
+        const size_t slot = MetricsThreadSlot::current();
+        auto& counters = shards[slot].counters;
+        auto count = [&](Metric metric, uint64_t amount) {
+            if (amount) bump(slot, counters[static_cast<size_t>(metric)], amount);
+        };
+        count(Metric::Probes, stats.probes);
+        count(Metric::HashHits, stats.hash_hits);
+        count(Metric::BloomRejects, stats.bloom_rejects);
+        count(Metric::BloomFalsePositives, stats.bloom_false_positives);
+        count(Metric::VerifiedCollisions, stats.verified_collisions);
+    }
+
+    // Count one query that took ns nanoseconds
+    void recordQuery(uint64_t ns) {
+        const size_t slot = MetricsThreadSlot::current();
+        Shard& mine = shards[slot];
+        bump(slot, mine.counters[static_cast<size_t>(Metric::Queries)], 1);
+        bump(slot, mine.latency[LatencyBuckets::indexOf(ns)], 1);
+        bump(slot, mine.latency_sum_ns, ns);
+        uint64_t max = mine.latency_max_ns.load(std::memory_order_relaxed);
+        while (ns > max && !mine.latency_max_ns.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+    }
+
+    MetricsSnapshot snapshot() const {
+        MetricsSnapshot out;
+        out.latency_buckets.assign(LatencyBuckets::COUNT, 0);
+        for (const Shard& s : shards) {
+            for (size_t m = 0; m < METRIC_COUNT; m++) out.counters[m] += s.counters[m].load(std::memory_order_relaxed);
+            for (size_t i = 0; i < LatencyBuckets::COUNT; i++) {
+                const uint64_t n = s.latency[i].load(std::memory_order_relaxed);
+                out.latency_buckets[i] += n;
+                out.latency_count += n;
+            }
+            out.latency_sum_ns += s.latency_sum_ns.load(std::memory_order_relaxed);
+            out.latency_max_ns = std::max(out.latency_max_ns, s.latency_max_ns.load(std::memory_order_relaxed));
+        }
+        return out;
+    }
+
+    // Zero everything, e.g. between benchmark phases; call it while no searches are running
+    void reset() {
+        for (Shard& s : shards) {
+            for (auto& c : s.counters) c.store(0, std::memory_order_relaxed);
+            for (auto& b : s.latency) b.store(0, std::memory_order_relaxed);
+            s.latency_sum_ns.store(0, std::memory_order_relaxed);
+            s.latency_max_ns.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::array<std::atomic<uint64_t>, METRIC_COUNT> counters{};
+        std::array<std::atomic<uint64_t>, LatencyBuckets::COUNT> latency{};
+        std::atomic<uint64_t> latency_sum_ns{0};
+        std::atomic<uint64_t> latency_max_ns{0};
+    };
+
+    std::array<Shard, MetricsThreadSlot::SLOTS + 1> shards;
+
+    // Single-writer slots skip the locked add; readers still see whole values
+    static void bump(size_t slot, std::atomic<uint64_t>& counter, uint64_t amount) {
+        if (slot == MetricsThreadSlot::OVERFLOW_SLOT) {
+            counter.fetch_add(amount, std::memory_order_relaxed);
+        } else {
+            counter.store(counter.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Prometheus text exposition of a snapshot, for an exporter to serve on /metrics
+inline void writeMetricsPrometheus(std::ostream& out, const MetricsSnapshot& snapshot,
+                                   const std::string& prefix = "rolling_hashset_") {
+    for (size_t m = 0; m < METRIC_COUNT; m++) {
+        const std::string name = prefix + metricName(static_cast<Metric>(m)) + "_total";
+        out << "# TYPE " << name << " counter\n" << name << " " << snapshot.counters[m] << "\n";
+    }
+    out << "# TYPE " << prefix << "index_entries gauge\n" << prefix << "index_entries " << snapshot.index_entries << "\n";
+    out << "# TYPE " << prefix << "index_bytes gauge\n" << prefix << "index_bytes " << snapshot.index_bytes << "\n";
+    out << "# TYPE " << prefix << "index_load_factor gauge\n" << prefix << "index_load_factor "
+        << snapshot.index_load_factor << "\n";
+
+    // Cumulative buckets at each non-empty bucket's upper edge, in seconds
+    const std::string latency = prefix + "query_latency_seconds";
+    out << "# TYPE " << latency << " histogram\n";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < snapshot.latency_buckets.size(); i++) {
+        if (snapshot.latency_buckets[i] == 0) continue;
+        cumulative += snapshot.latency_buckets[i];
+        if (i + 1 < LatencyBuckets::COUNT) {
+            out << latency << "_bucket{le=\"" << static_cast<double>(LatencyBuckets::lowerBound(i + 1)) * 1e-9
+                << "\"} " << cumulative << "\n";
+        }
+    }
+    out << latency << "_bucket{le=\"+Inf\"} " << snapshot.latency_count << "\n";
+    out << latency << "_sum " << static_cast<double>(snapshot.latency_sum_ns) * 1e-9 << "\n";
+    out << latency << "_count " << snapshot.latency_count << "\n";
+}
+
+// Hardware events sampled around timed code
+enum class PerfEvent : size_t {
+    Cycles,
+    Instructions,
+    L1dMisses,      // L1 data cache read misses
+    LlcMisses,      // last-level cache misses
+    BranchMisses
+};
+
+inline const char* perfEventName(PerfEvent event) {
+    switch (event) {
+        case PerfEvent::Cycles: return "cycles";
+        case PerfEvent::Instructions: return "instructions";
+        case PerfEvent::L1dMisses: return "l1d_misses";
+        case PerfEvent::LlcMisses: return "llc_misses";
+        case PerfEvent::BranchMisses: return "branch_misses";
+    }
+    return "unknown";
+}
+
+// Event counts for one measured region; a negative count means the event was not measured
+struct PerfCounterValues {
+    static constexpr size_t EVENT_COUNT = 5;
+    std::array<double, EVENT_COUNT> counts = {-1.0, -1.0, -1.0, -1.0, -1.0};
+    bool cycles_from_tsc = false;   // cycles are time-stamp counter ticks, not core cycles
+
+    double get(PerfEvent event) const { return counts[static_cast<size_t>(event)]; }
+    bool has(PerfEvent event) const { return get(event) >= 0.0; }
+    bool any() const {
+        return std::any_of(counts.begin(), counts.end(), [](double c) { return c >= 0.0; });
+    }
+
+    // Instructions per cycle, or -1 when either count is missing
+    double ipc() const {
+        if (!has(PerfEvent::Instructions) || !has(PerfEvent::Cycles) || get(PerfEvent::Cycles) == 0.0) {
+            return -1.0;
+        }
+        return get(PerfEvent::Instructions) / get(PerfEvent::Cycles);
+    }
+
+    // event count per unit, e.g. misses per input byte; -1 when not measured
+    double per(PerfEvent event, double units) const {
+        return has(event) && units > 0.0 ? get(event) / units : -1.0;
+    }
+
+    PerfCounterValues scaled(double factor) const {
+        PerfCounterValues result = *this;
+        for (double& c : result.counts) {
+            if (c >= 0.0) c *= factor;
+        }
+        return result;
+    }
+};
+
+// Counts hardware events of the calling thread (and threads it starts) between start() and stop()
+// Uses perf_event_open on Linux; each event is opened on its own so an unsupported one
+// (common in VMs and containers) only drops that event. Counts are scaled for multiplexing.
+// Where no event can be opened, cycles fall back to the x86 time-stamp counter and the
+// remaining events are reported as not measured.
+class PerfCounters {
+public:
+    PerfCounters() {
+#ifdef ROLLING_HASHSET_HAS_PERF_EVENT
+        const std::pair<uint32_t, uint64_t> configs[PerfCounterValues::EVENT_COUNT] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                 (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        };
+        for (size_t e = 0; e < PerfCounterValues::EVENT_COUNT; e++) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = configs[e].first;
+            attr.config = configs[e].second;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            fds[e] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+#endif
+    }
+
+    ~PerfCounters() {
+#ifdef ROLLING_HASHSET_HAS_PERF_EVENT
+        for (int fd : fds) {
+            if (fd >= 0) close(fd);
+        }
+#endif
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // True when at least one hardware event is being counted by the kernel
+    bool available() const {
+        return std::any_of(std::begin(fds), std::end(fds), [](int fd) { return fd >= 0; });
+    }
+
+    void start() {
+#ifdef ROLLING_HASHSET_HAS_PERF_EVENT
+        for (int fd : fds) {
+            if (fd < 0) continue;
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+        tsc_start = readTsc();
+    }
+
+    PerfCounterValues stop() {
+        const uint64_t tsc_end = readTsc();
+        PerfCounterValues values;
+#ifdef ROLLING_HASHSET_HAS_PERF_EVENT
+        for (size_t e = 0; e < PerfCounterValues::EVENT_COUNT; e++) {
+            if (fds[e] < 0) continue;
+            ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t data[3] = {0, 0, 0};   // value, time enabled, time running
+            if (read(fds[e], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data))) continue;
+            values.counts[e] = data[2] == 0 ? 0.0
+                                            : static_cast<double>(data[0]) * static_cast<double>(data[1]) /
+                                                  static_cast<double>(data[2]);
+        }
+#endif
+        if (!values.has(PerfEvent::Cycles) && tsc_end != 0) {
+            values.counts[static_cast<size_t>(PerfEvent::Cycles)] = static_cast<double>(tsc_end - tsc_start);
+            values.cycles_from_tsc = true;
+        }
+        return values;
+    }
+
+    // Process-wide instance, opened on first use
+    static PerfCounters& shared() {
+        static PerfCounters counters;
+        return counters;
+    }
+
+private:
+    int fds[PerfCounterValues::EVENT_COUNT] = {-1, -1, -1, -1, -1};
+    uint64_t tsc_start = 0;
+
+    static uint64_t readTsc() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+    }
+};
+
+// Keep value (and everything it depends on) from being optimized away in a benchmark loop
+template<typename T>
+inline void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    const volatile char* p = reinterpret_cast<const volatile char*>(&value);
+    (void)*p;
+#endif
+}
+
+struct BenchmarkOptions {
+    size_t warmup_runs = 3;          // untimed runs before sampling, and at least min_warmup_ms of them
+    double min_warmup_ms = 5.0;
+    size_t samples = 30;
+    size_t min_samples = 5;          // max_case_ms never cuts a case below this
+    double min_sample_us = 200.0;    // short operations are batched until a sample lasts this long
+    double max_case_ms = 2000.0;     // stop sampling once a case has used this much time
+};
+
+// Per-operation timing summary in nanoseconds
+struct BenchmarkStats {
+    size_t samples = 0;
+    size_t runs_per_sample = 0;
+    double mean = 0.0;
+    double stddev = 0.0;             // sample standard deviation
+    double ci95_low = 0.0;           // normal-approximation 95% interval for the mean
+    double ci95_high = 0.0;
+    double min = 0.0;
+    double median = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+    PerfCounterValues counters;      // per operation, from one extra counted sample
+};
+
+// Summary of per-operation sample times; percentiles interpolate between ranks
+inline BenchmarkStats summarizeSamples(std::vector<double> ns) {
+    BenchmarkStats stats;
+    stats.samples = ns.size();
+    if (ns.empty()) return stats;
+    std::sort(ns.begin(), ns.end());
+    auto percentile = [&ns](double p) {
+        const double rank = p * static_cast<double>(ns.size() - 1);
+        const size_t lo = static_cast<size_t>(rank);
+        const size_t hi = std::min(lo + 1, ns.size() - 1);
+        return ns[lo] + (ns[hi] - ns[lo]) * (rank - static_cast<double>(lo));
+    };
+    const double n = static_cast<double>(ns.size());
+    stats.mean = std::accumulate(ns.begin(), ns.end(), 0.0) / n;
+    double squares = 0.0;
+    for (double x : ns) squares += (x - stats.mean) * (x - stats.mean);
+    stats.stddev = ns.size() > 1 ? std::sqrt(squares / (n - 1.0)) : 0.0;
+    const double half_width = 1.96 * stats.stddev / std::sqrt(n);
+    stats.ci95_low = stats.mean - half_width;
+    stats.ci95_high = stats.mean + half_width;
+    stats.min = ns.front();
+    stats.median = percentile(0.5);
+    stats.p95 = percentile(0.95);
+    stats.p99 = percentile(0.99);
+    stats.max = ns.back();
+    return stats;
+}
+
+// Time op() after a warm-up phase
+// The warm-up also sizes the batch: each sample runs op() enough times to last at least
+// min_sample_us, so the clock resolution does not dominate short operations.
+template<typename Op>
+BenchmarkStats runBenchmark(Op&& op, const BenchmarkOptions& options = {}) {
+    using Clock = std::chrono::steady_clock;
+    auto elapsed_ns = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::nano>(Clock::now() - since).count();
+    };
+
+    double fastest_run_ns = std::numeric_limits<double>::max();
+    const auto warmup_start = Clock::now();
+    for (size_t i = 0; i < std::max<size_t>(options.warmup_runs, 1) ||
+                       elapsed_ns(warmup_start) < options.min_warmup_ms * 1e6; i++) {
+        const auto start = Clock::now();
+        op();
+        fastest_run_ns = std::min(fastest_run_ns, elapsed_ns(start));
+    }
+    const size_t runs = std::max<size_t>(
+        1, static_cast<size_t>(std::ceil(options.min_sample_us * 1e3 / std::max(fastest_run_ns, 1.0))));
+
+    std::vector<double> ns;
+    ns.reserve(options.samples);
+    const auto case_start = Clock::now();
+    for (size_t s = 0; s < options.samples; s++) {
+        if (s >= options.min_samples && elapsed_ns(case_start) > options.max_case_ms * 1e6) break;
+        const auto start = Clock::now();
+        for (size_t r = 0; r < runs; r++) op();
+        ns.push_back(elapsed_ns(start) / static_cast<double>(runs));
+    }
+    BenchmarkStats stats = summarizeSamples(std::move(ns));
+    stats.runs_per_sample = runs;
+
+    PerfCounters& counters = PerfCounters::shared();
+    counters.start();
+    for (size_t r = 0; r < runs; r++) op();
+    stats.counters = counters.stop().scaled(1.0 / static_cast<double>(runs));
+    return stats;
+}
+
+// Uniform range of pattern lengths for a benchmark case
+struct PatternLengthRange {
+    size_t min_length = 8;
+    size_t max_length = 8;
+};
+
+// Kind of text produced by WorkloadGenerator
+enum class TextKind {
+    Lowercase,   // uniform over a-z
+    Dna,         // uniform over ACGT
+    Ascii,       // uniform over printable ASCII
+    Bytes,       // uniform over all 256 byte values
+    Zipf,        // words drawn from a Zipf-distributed vocabulary, like natural language
+    Log          // timestamped application log lines
+};
+
+inline const char* textKindName(TextKind kind) {
+    switch (kind) {
+        case TextKind::Lowercase: return "lowercase";
+        case TextKind::Dna: return "dna";
+        case TextKind::Ascii: return "ascii";
+        case TextKind::Bytes: return "bytes";
+        case TextKind::Zipf: return "zipf";
+        case TextKind::Log: return "log";
+    }
+    return "unknown";
+}
+
+inline TextKind parseTextKind(const std::string& name) {
+    for (TextKind kind : {TextKind::Lowercase, TextKind::Dna, TextKind::Ascii, TextKind::Bytes,
+                          TextKind::Zipf, TextKind::Log}) {
+        if (name == textKindName(kind)) return kind;
+    }
+    throw std::invalid_argument("unknown text kind " + name);
+}
+
+// Seeded generator of benchmark texts and pattern sets
+// The same seed always gives the same workload, so runs at any scale can be reproduced.
+class WorkloadGenerator {
+public:
+    explicit WorkloadGenerator(uint64_t seed = 1) : rng(seed) {}
+
+    std::string text(TextKind kind, size_t n) {
+        switch (kind) {
+            case TextKind::Lowercase: return uniformText(n, "abcdefghijklmnopqrstuvwxyz");
+            case TextKind::Dna: return uniformText(n, "ACGT");
+            case TextKind::Ascii: {
+                std::string alphabet;
+                for (char c = ' '; c <= '~'; c++) alphabet += c;
+                return uniformText(n, alphabet);
+            }
+            case TextKind::Bytes: {
+                std::string result(n, '\0');
+                for (char& c : result) c = static_cast<char>(rng() & 0xff);
+                return result;
+            }
+            case TextKind::Zipf: return zipfText(n);
+            case TextKind::Log: return logText(n);
+        }
+        return {};
+    }
+
+    // count patterns with lengths uniform in lengths; about hit_rate of them occur in text
+    // Hits are cut from random offsets of text. Misses are drawn like text of the same kind
+    // and any that occur anyway are redrawn (checked with one Aho-Corasick scan per round);
+    // on very small alphabets a few short misses may still turn out to be present.
+    std::vector<std::string> patterns(std::string_view text, TextKind kind, size_t count,
+                                      const PatternLengthRange& lengths, double hit_rate) {
+        std::vector<std::string> result(count);
+        std::vector<size_t> misses;
+        for (size_t i = 0; i < count; i++) {
+            const size_t span = lengths.max_length - std::min(lengths.min_length, lengths.max_length);
+            const size_t len = std::max<size_t>(lengths.min_length + static_cast<size_t>(rng() % (span + 1)), 1);
+            const bool hit = len <= text.length() && uniform() < hit_rate;
+            if (hit) {
+                result[i] = std::string(text.substr(rng() % (text.length() - len + 1), len));
+            } else {
+                result[i] = missCandidate(kind, len);
+                misses.push_back(i);
+            }
+        }
+
+        for (int round = 0; round < 4 && !misses.empty(); round++) {
+            PatternViews candidates;
+            for (size_t i : misses) candidates.push_back(result[i]);
+            std::vector<bool> present = AhoCorasickAutomaton(candidates).findPresent(text.data(), text.length());
+            std::vector<size_t> still_present;
+            for (size_t j = 0; j < misses.size(); j++) {
+                if (!present[j]) continue;
+                result[misses[j]] = missCandidate(kind, result[misses[j]].length());
+                still_present.push_back(misses[j]);
+            }
+            misses = std::move(still_present);
+        }
+        return result;
+    }
+
+    // count short records: log lines for Log, otherwise 40-160 byte pieces of text(kind)
+    std::vector<std::string> records(TextKind kind, size_t count) {
+        std::vector<std::string> result;
+        result.reserve(count);
+        while (result.size() < count) {
+            const std::string chunk = text(kind, 64 << 10);
+            size_t start = 0;
+            while (result.size() < count && start < chunk.length()) {
+                size_t end;
+                if (kind == TextKind::Log) {
+                    end = chunk.find('\n', start);
+                    if (end == std::string::npos) break;   // partial last line
+                } else {
+                    end = std::min(chunk.length(), start + 40 + static_cast<size_t>(rng() % 121));
+                }
+                result.push_back(chunk.substr(start, end - start));
+                start = end + (kind == TextKind::Log ? 1 : 0);
+            }
+        }
+        return result;
+    }
+
+private:
+    std::mt19937_64 rng;
+    std::vector<std::string> vocabulary;
+    std::vector<double> vocabulary_cdf;
+
+    double uniform() { return static_cast<double>(rng() >> 11) * (1.0 / 9007199254740992.0); }
+
+    std::string uniformText(size_t n, std::string_view alphabet) {
+        std::string result(n, '\0');
+        for (char& c : result) c = alphabet[rng() % alphabet.length()];
+        return result;
+    }
+
+    // Word-based kinds draw misses as uniform lowercase strings, which rarely line up with real words
+    std::string missCandidate(TextKind kind, size_t len) {
+        if (kind == TextKind::Zipf || kind == TextKind::Log) return uniformText(len, "abcdefghijklmnopqrstuvwxyz");
+        return text(kind, len);
+    }
+
+    // Vocabulary of 50k words with Zipf(s = 1) frequencies; rank 1 is the most common
+    void buildVocabulary() {
+        const size_t words = 50000;
+        vocabulary.reserve(words);
+        vocabulary_cdf.reserve(words);
+        double total = 0.0;
+        for (size_t rank = 1; rank <= words; rank++) {
+            // Common words are short, as in natural language
+            const size_t len = 1 + std::min<size_t>(static_cast<size_t>(std::log2(static_cast<double>(rank))) / 2 +
+                                                        rng() % 4, 14);
+            vocabulary.push_back(uniformText(len, "etaoinshrdlcumwfgypbvkjxqz"));
+            total += 1.0 / static_cast<double>(rank);
+            vocabulary_cdf.push_back(total);
+        }
+        for (double& c : vocabulary_cdf) c /= total;
+    }
+
+    std::string zipfText(size_t n) {
+        if (vocabulary.empty()) buildVocabulary();
+        std::string result;
+        result.reserve(n + 16);
+        size_t sentence = 0;
+        while (result.length() < n) {
+            const double u = uniform();
+            const size_t rank = static_cast<size_t>(
+                std::lower_bound(vocabulary_cdf.begin(), vocabulary_cdf.end(), u) - vocabulary_cdf.begin());
+            result += vocabulary[std::min(rank, vocabulary.size() - 1)];
+            if (++sentence >= 8 + rng() % 12) {
+                result += rng() % 4 ? ". " : ".\n";
+                sentence = 0;
+            } else {
+                result += rng() % 10 ? " " : ", ";
+            }
+        }
+        result.resize(n);
+        return result;
+    }
+
+    std::string logText(size_t n) {
+        static const char* const levels[] = {"INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR"};
+        static const char* const services[] = {"api", "auth", "billing", "search", "worker", "gateway"};
+        static const char* const paths[] = {"/api/v1/items", "/api/v1/users", "/api/v2/search",
+                                            "/login", "/health", "/api/v1/orders"};
+        static const int statuses[] = {200, 200, 200, 201, 204, 301, 400, 404, 500, 503};
+        std::string result;
+        result.reserve(n + 256);
+        uint64_t millis = 1700000000000ULL + rng() % 1000000;
+        char line[256];
+        while (result.length() < n) {
+            millis += rng() % 50;
+            const uint64_t seconds = millis / 1000;
+            const int written = std::snprintf(
+                line, sizeof(line),
+                "2026-10-%02u %02u:%02u:%02u.%03u %s [%s-%u] request_id=%016llx path=%s/%u status=%d latency_ms=%u\n",
+                static_cast<unsigned>(1 + (seconds / 86400) % 28), static_cast<unsigned>((seconds / 3600) % 24),
+                static_cast<unsigned>((seconds / 60) % 60), static_cast<unsigned>(seconds % 60),
+                static_cast<unsigned>(millis % 1000), levels[rng() % 6], services[rng() % 6],
+                static_cast<unsigned>(rng() % 32), static_cast<unsigned long long>(rng()), paths[rng() % 6],
+                static_cast<unsigned>(rng() % 100000), statuses[rng() % 10], static_cast<unsigned>(rng() % 2000));
+            result.append(line, static_cast<size_t>(std::max(written, 0)));
+        }
+        result.resize(n);
+        return result;
+    }
+};
+
+// One measured point of a benchmark sweep
+struct BenchmarkResult {
+    std::string name;
+    SearchStrategy strategy = SearchStrategy::Auto;
+    TextKind text_kind = TextKind::Lowercase;
+    double hit_rate = 0.0;
+    size_t text_length = 0;
+    size_t pattern_count = 0;
+    PatternLengthRange lengths;
+    size_t matches = 0;
+    size_t records = 0;              // record batch cases only; text_length is then their total size
+    size_t probes = 0;               // index probe cases only: patterns probed per run
+    BenchmarkStats stats;
+
+    // Records searched per second at the median time, or -1 for whole-text cases
+    double recordsPerSecond() const {
+        if (records == 0 || stats.median <= 0.0) return -1.0;
+        return static_cast<double>(records) / (stats.median * 1e-9);
+    }
+
+    // Index probes per second at the median time, or -1 for other cases
+    double probesPerSecond() const {
+        if (probes == 0 || stats.median <= 0.0) return -1.0;
+        return static_cast<double>(probes) / (stats.median * 1e-9);
+    }
+};
+
+// Cartesian product of these parameters is measured by RollingHashSet::runBenchmarkSweep
+struct BenchmarkSweep {
+    std::vector<size_t> text_lengths = {1 << 10, 1 << 16, 1 << 20};
+    std::vector<size_t> pattern_counts = {10, 100, 1000};
+    std::vector<PatternLengthRange> pattern_lengths = {{8, 8}, {4, 32}};
+    std::vector<SearchStrategy> strategies = {SearchStrategy::BruteForce, SearchStrategy::RollingHash,
+                                              SearchStrategy::ReverseHash, SearchStrategy::AhoCorasick,
+                                              SearchStrategy::FmIndex};
+    TextKind text_kind = TextKind::Lowercase;
+    double hit_rate = 0.5;           // share of patterns that occur in the text
+    uint64_t seed = 1;
+    size_t record_count = 0;         // > 0: measure batches of this many records instead of whole texts
+    bool index_probes = false;       // measure persistent-index probes with and without prefetching
+    BenchmarkOptions options;
+};
+
+inline void writeBenchmarkCsv(std::ostream& out, const std::vector<BenchmarkResult>& results) {
+    out << "name,strategy,text_kind,hit_rate,text_length,pattern_count,min_pattern_length,max_pattern_length,matches,"
+           "samples,runs_per_sample,mean_ns,stddev_ns,ci95_low_ns,ci95_high_ns,min_ns,median_ns,"
+           "p95_ns,p99_ns,max_ns,cycles,instructions,ipc,l1d_misses_per_byte,llc_misses_per_byte,"
+           "branch_misses,cycles_from_tsc,records,records_per_second,probes,probes_per_second\n";
+    auto counter = [&out](double value) -> std::ostream& {
+        if (value >= 0.0) out << value;
+        return out;
+    };
+    for (const auto& r : results) {
+        const BenchmarkStats& s = r.stats;
+        out << r.name << ',' << strategyName(r.strategy) << ',' << textKindName(r.text_kind) << ','
+            << r.hit_rate << ',' << r.text_length << ',' << r.pattern_count
+            << ',' << r.lengths.min_length << ',' << r.lengths.max_length << ',' << r.matches << ','
+            << s.samples << ',' << s.runs_per_sample << ',' << s.mean << ',' << s.stddev << ','
+            << s.ci95_low << ',' << s.ci95_high << ',' << s.min << ',' << s.median << ',' << s.p95 << ','
+            << s.p99 << ',' << s.max << ',';
+        const double bytes = static_cast<double>(r.text_length);
+        counter(s.counters.get(PerfEvent::Cycles)) << ',';
+        counter(s.counters.get(PerfEvent::Instructions)) << ',';
+        counter(s.counters.ipc()) << ',';
+        counter(s.counters.per(PerfEvent::L1dMisses, bytes)) << ',';
+        counter(s.counters.per(PerfEvent::LlcMisses, bytes)) << ',';
+        counter(s.counters.get(PerfEvent::BranchMisses)) << ',';
+        out << (s.counters.cycles_from_tsc ? "true" : "false") << ',' << r.records << ',';
+        counter(r.recordsPerSecond()) << ',' << r.probes << ',';
+        counter(r.probesPerSecond()) << '\n';
+    }
+}
+
+inline void writeBenchmarkJson(std::ostream& out, const std::vector<BenchmarkResult>& results) {
+    // Unmeasured counters are written as null
+    auto counter = [&out](const char* key, double value) {
+        out << ", \"" << key << "\": ";
+        if (value >= 0.0) out << value;
+        else out << "null";
+    };
+    out << "{\"kernel\": \"" << simd_find::kernelName() << "\", \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& r = results[i];
+        const BenchmarkStats& s = r.stats;
+        out << (i ? ",\n" : "\n") << "  {\"name\": \"" << r.name << "\", \"strategy\": \""
+            << strategyName(r.strategy) << "\", \"text_kind\": \"" << textKindName(r.text_kind)
+            << "\", \"hit_rate\": " << r.hit_rate << ", \"text_length\": " << r.text_length
+            << ", \"pattern_count\": " << r.pattern_count
+            << ", \"min_pattern_length\": " << r.lengths.min_length
+            << ", \"max_pattern_length\": " << r.lengths.max_length << ", \"matches\": " << r.matches
+            << ", \"samples\": " << s.samples << ", \"runs_per_sample\": " << s.runs_per_sample
+            << ", \"mean_ns\": " << s.mean << ", \"stddev_ns\": " << s.stddev
+            << ", \"ci95_low_ns\": " << s.ci95_low << ", \"ci95_high_ns\": " << s.ci95_high
+            << ", \"min_ns\": " << s.min << ", \"median_ns\": " << s.median << ", \"p95_ns\": " << s.p95
+            << ", \"p99_ns\": " << s.p99 << ", \"max_ns\": " << s.max;
+        const double bytes = static_cast<double>(r.text_length);
+        counter("cycles", s.counters.get(PerfEvent::Cycles));
+        counter("instructions", s.counters.get(PerfEvent::Instructions));
+        counter("ipc", s.counters.ipc());
+        counter("l1d_misses_per_byte", s.counters.per(PerfEvent::L1dMisses, bytes));
+        counter("llc_misses_per_byte", s.counters.per(PerfEvent::LlcMisses, bytes));
+        counter("branch_misses", s.counters.get(PerfEvent::BranchMisses));
+        out << ", \"cycles_from_tsc\": " << (s.counters.cycles_from_tsc ? "true" : "false")
+            << ", \"records\": " << r.records;
+        counter("records_per_second", r.recordsPerSecond());
+        out << ", \"probes\": " << r.probes;
+        counter("probes_per_second", r.probesPerSecond());
+        out << "}";
+    }
+    out << "\n]}\n";
+}
+
+// Reusable working memory for repeated rolling hash searches
+// Indexes, the Bloom filter, the length list and the result are emptied between calls but
+// keep their storage, so once a context has seen a search of a given shape, further searches
+// of that shape (on one thread) make no heap allocations. Call clear() to release the memory.
+class SearchContext {
+public:
+    // Result of the last search run with this context
+    const std::vector<size_t>& matches() const { return result; }
+
+    size_t memoryBytes() const {
+        return primary.memoryBytes() + secondary.memoryBytes() + verified.memoryBytes() +
+               bloom.memoryBytes() + (lengths.capacity() + result.capacity()) * sizeof(size_t);
+    }
+
+    void clear() { *this = SearchContext{}; }
+
+private:
+    friend class RollingHashSet;
+
+    std::vector<size_t> lengths;
+    SubstringHashIndex primary;
+    SubstringHashIndex secondary;
+    VerifiedSubstringIndex verified;
+    BlockedBloomFilter bloom;
+    std::vector<size_t> result;
+};
 
 class RollingHashSet {
 private:
-    std::unordered_set<size_t> substring_hashes;
+    static constexpr uint64_t SECONDARY_BASE = 911382323;
+
+    // Persistent index over the live text, filled by index(), grown by query() and append()
+    // Offsets are positions in the stream of all indexed bytes; indexed_text holds the
+    // bytes from indexed_base on, of which those before window_start have been evicted.
+    std::string indexed_text;
+    size_t indexed_base = 0;
+    size_t window_start = 0;
+    size_t sliding_window = 0;                 // bytes kept indexed by append(); 0 keeps all
+    SubstringHashIndex substring_hashes;
+    SubstringHashIndex secondary_substring_hashes;
+    VerifiedSubstringIndex verified_substring_index;
+    // Windows per hash for each index above; only kept while sliding_window is set
+    using WindowCountIndex = LengthBucketedIndex<FlatHashMap<uint32_t>>;
+    WindowCountIndex substring_counts;
+    WindowCountIndex secondary_substring_counts;
+    WindowCountIndex verified_substring_counts;
+    BlockedBloomFilter substring_bloom;        // over (length, hash) keys of the index above
+    bool substring_bloom_stale = true;
+    // Per-node copies of the three indexes above under NumaPlacement::Replicate, in the
+    // order of index_memory::nodes(); refreshed by the first query after the index changes
+    struct IndexReplica {
+        int node = 0;
+        SubstringHashIndex primary;
+        SubstringHashIndex secondary;
+        VerifiedSubstringIndex verified;
+    };
+    std::vector<IndexReplica> replicas;
+    bool replicas_stale = true;
+    bool substring_bloom_verified = false;     // built from verified_substring_index
+
+    RollingHasher hasher;
+    RollingHasher secondary_hasher;
+    SearchStats last_stats;
+    PerfCounterValues last_perf_counters;
+    SearchConfig search_config;
+    SearchStrategy last_strategy = SearchStrategy::Auto;
+    SearchMetrics* metrics = &SearchMetrics::global();
+    int query_depth = 0;                       // nested QueryScopes; only the outermost records
+
+    static constexpr size_t HASH_LANES = 8;
+    // Probes hashed and prefetched together before any of them is resolved: enough to
+    // cover a DRAM miss with the hashing of the others, few enough for the line fill buffers
+    static constexpr size_t PROBE_BATCH = 32;
+    // Reverse mode prefetches only pattern tables that overflow a typical L2
+    static constexpr size_t PREFETCH_MIN_TABLE_BYTES = 1 << 20;
+
+    // Counts one query and its latency in metrics when the outermost public call returns,
+    // so search() dispatching to another public search records a single query. Searches
+    // that count into last_stats directly, where every probe is a rolled window, pass
+    // owns_stats so last_stats is added on return.
+    class QueryScope {
+    public:
+        explicit QueryScope(RollingHashSet& set, bool owns_stats = false) : set(set), owns_stats(owns_stats) {
+            if (set.query_depth++ == 0 && set.metrics) start = std::chrono::steady_clock::now();
+        }
+        ~QueryScope() {
+            if (owns_stats && set.metrics) {
+                set.metrics->add(set.last_stats);
+                set.metrics->add(Metric::WindowsHashed, set.last_stats.probes);
+            }
+            if (--set.query_depth == 0 && set.metrics) {
+                set.metrics->recordQuery(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count()));
+            }
+        }
+        QueryScope(const QueryScope&) = delete;
+        QueryScope& operator=(const QueryScope&) = delete;
+
+    private:
+        RollingHashSet& set;
+        bool owns_stats;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    void countWindows(size_t windows) {
+        if (metrics) metrics->add(Metric::WindowsHashed, windows);
+    }
+
+    // Give every persistent index the configured memory policy; filled ones move over
+    void applyIndexMemory() {
+        const IndexMemoryPolicy& policy = search_config.index_memory;
+        substring_hashes.setMemoryPolicy(policy);
+        secondary_substring_hashes.setMemoryPolicy(policy);
+        verified_substring_index.setMemoryPolicy(policy);
+        substring_counts.setMemoryPolicy(policy);
+        secondary_substring_counts.setMemoryPolicy(policy);
+        verified_substring_counts.setMemoryPolicy(policy);
+        replicas.clear();
+        replicas_stale = true;
+    }
+
+    // Replica on the calling thread's node under NumaPlacement::Replicate, copied from the
+    // persistent index with its pages bound to that node; nullptr means probe the original
+    const IndexReplica* localReplica() {
+        if (search_config.index_memory.placement != NumaPlacement::Replicate) return nullptr;
+        const std::vector<int>& nodes = index_memory::nodes();
+        if (nodes.size() < 2) return nullptr;
+        if (replicas_stale) {
+            replicas.clear();
+            for (int node : nodes) {
+                IndexMemoryPolicy policy = search_config.index_memory;
+                policy.node = node;
+                replicas.push_back(IndexReplica{node, SubstringHashIndex(substring_hashes, policy),
+                                                SubstringHashIndex(secondary_substring_hashes, policy),
+                                                VerifiedSubstringIndex(verified_substring_index, policy)});
+            }
+            replicas_stale = false;
+        }
+        const int here = index_memory::currentNode();
+        for (const IndexReplica& replica : replicas) {
+            if (replica.node == here) return &replica;
+        }
+        return nullptr;
+    }
+
+    // Call f(offset, hash) for every window of length len in data[0, n)
+    // Long runs use the multi-lane kernel; offsets then arrive grouped by lane.
+    template<typename F>
+    static void forEachWindowHash(const RollingHasher& h, const char* data, size_t n,
+                                  size_t len, F&& f) {
+        if (len == 0 || len > n) return;
+        if (n - len + 1 >= HASH_LANES * 64) {
+            h.forEachWindowHashLanes<HASH_LANES>(data, n, len, f);
+            return;
+        }
+        const uint64_t out_power = h.power(len - 1);
+        uint64_t value = h.hash(data, len);
+        f(size_t{0}, value);
+        for (size_t i = 1; i + len <= n; i++) {
+            value = h.roll(value, data[i - 1], data[i + len - 1], out_power);
+            f(i, value);
+        }
+    }
+
+    // Insert every window of length len of text into bucket (keys, or key -> offset for maps)
+    // Large texts are split into one chunk per thread; each thread rolls its own hash over
+    // its chunk and sorts the hashes by owner range so insertPartitioned can fill disjoint
+    // parts of the table concurrently.
+    template<typename Bucket>
+    void fillBucket(Bucket& bucket, const RollingHasher& h, std::string_view text, size_t len,
+                    size_t offset_base = 0) {
+        const size_t windows = text.length() - len + 1;
+        countWindows(windows);
+        bucket.reserve(windows);
+        const size_t threads = std::min(configuredThreads(),
+                                        windows / std::max<size_t>(search_config.min_windows_per_thread, 1));
+
+        if (threads <= 1) {
+            forEachWindowHash(h, text.data(), text.length(), len, [&](size_t offset, uint64_t value) {
+                if constexpr (Bucket::HAS_VALUE) bucket.emplace(value, offset_base + offset);
+                else bucket.insert(value);
+            });
+            return;
+        }
+
+        using Entry = typename Bucket::Entry;
+        std::vector<std::vector<std::vector<Entry>>> parts(threads, std::vector<std::vector<Entry>>(threads));
+        parallelFor(threads, [&](size_t t) {
+            const size_t first = windows * t / threads;
+            const size_t last = windows * (t + 1) / threads;
+            auto& mine = parts[t];
+            for (auto& owner_entries : mine) owner_entries.reserve((last - first) / threads + 16);
+            forEachWindowHash(h, text.data() + first, last - first + len - 1, len,
+                              [&](size_t offset, uint64_t value) {
+                                  auto& out = mine[bucket.ownerOf(value, threads)];
+                                  if constexpr (Bucket::HAS_VALUE) out.emplace_back(value, offset_base + first + offset);
+                                  else out.push_back(value);
+                              });
+        });
+        bucket.insertPartitioned(parts);
+    }
+
+    // Bloom filter key for a window hash of a given length
+    static uint64_t bloomKey(size_t length, uint64_t h) {
+        return h ^ (static_cast<uint64_t>(length) * 0x9e3779b97f4a7c15ULL);
+    }
+
+    // Filter over every (length, hash) key of index
+    template<typename Index>
+    BlockedBloomFilter buildBloomFilter(const Index& index) const {
+        BlockedBloomFilter bloom;
+        fillBloomFilter(bloom, index);
+        return bloom;
+    }
+
+    template<typename Index>
+    void fillBloomFilter(BlockedBloomFilter& bloom, const Index& index) const {
+        bloom.reset(index.size(), search_config.bloom_bits_per_key, search_config.bloom_max_bytes);
+        for (const auto& [length, bucket] : index) {
+            const size_t len = length;
+            bucket.forEach([&](uint64_t h, auto&&...) { bloom.insert(bloomKey(len, h)); });
+        }
+    }
+
+    // Probe prebuilt indexes over text; only the indexes used by mode need to be filled
+    // The indexes are read-only here, so large pattern sets are probed in parallel.
+    std::vector<size_t> probeIndex(std::string_view text,
+                                   const SubstringHashIndex& primary,
+                                   const SubstringHashIndex& secondary,
+                                   const VerifiedSubstringIndex& verified,
+                                   const PatternViews& substrings,
+                                   MatchMode mode,
+                                   const BlockedBloomFilter* bloom = nullptr,
+                                   size_t offset_base = 0) {
+        std::vector<size_t> result;
+        probeIndexInto(result, text, primary, secondary, verified, substrings, mode, bloom, offset_base);
+        return result;
+    }
+
+    // probeIndex writing the matching pattern indices into result, replacing its contents
+    // Offsets in verified are relative to text.data() - offset_base.
+    void probeIndexInto(std::vector<size_t>& result,
+                        std::string_view text,
+                        const SubstringHashIndex& primary,
+                        const SubstringHashIndex& secondary,
+                        const VerifiedSubstringIndex& verified,
+                        const PatternViews& substrings,
+                        MatchMode mode,
+                        const BlockedBloomFilter* bloom,
+                        size_t offset_base = 0) {
+        const size_t workers = workersFor(substrings.size(), search_config.min_probes_per_thread);
+        if (bloom && bloom->empty()) bloom = nullptr;
+        if (bloom) {
+            last_stats.bloom_bytes = bloom->memoryBytes();
+            last_stats.bloom_estimated_false_positive_rate = bloom->estimatedFalsePositiveRate();
+        }
+        // False when the filter proves the (length, hash) key absent
+        auto passesBloom = [bloom](std::string_view substring, uint64_t h, SearchStats& stats) {
+            if (!bloom || bloom->mayContain(bloomKey(substring.length(), h))) return true;
+            stats.bloom_rejects++;
+            return false;
+        };
+
+        // Patterns are hashed and their slots prefetched PROBE_BATCH at a time, then resolved;
+        // a null bucket in the state means the pattern is already known to be absent
+        const size_t batch = search_config.prefetch_probes ? PROBE_BATCH : 1;
+        if (mode == MatchMode::Verified) {
+            struct Probe {
+                const FlatHashMap<size_t>* bucket;
+                uint64_t h;
+            };
+            collectPipelinedMatchIndicesInto<Probe>(result, substrings.size(), workers, batch,
+                [&](size_t i, Probe& probe, SearchStats& stats) {
+                    const std::string_view substring = substrings[i];
+                    stats.probes++;
+                    probe.bucket = verified.find(substring.length());
+                    if (!probe.bucket) return;
+                    probe.h = hasher.hash(substring);
+                    if (!passesBloom(substring, probe.h, stats)) probe.bucket = nullptr;
+                    else probe.bucket->prefetch(probe.h);
+                },
+                [&](size_t i, const Probe& probe, SearchStats& stats) {
+                    if (!probe.bucket) return false;
+                    const size_t* offset = probe.bucket->find(probe.h);
+                    if (!offset) {
+                        if (bloom) stats.bloom_false_positives++;
+                        return false;
+                    }
+                    stats.hash_hits++;
+                    const std::string_view substring = substrings[i];
+                    const ByteMap& byte_map = search_config.byte_map;
+                    bool found = byte_map.equal(text.data() + (*offset - offset_base), substring.data(),
+                                                substring.length());
+                    if (!found) {
+                        stats.verified_collisions++;
+                        found = simd_find::find(text, substring, byte_map) != std::string_view::npos;
+                    }
+                    return found;
+                });
+            return;
+        }
+
+        // estimated_false_positive_rate accumulates a sum here and is averaged below
+        struct Probe {
+            const FlatHashSet* bucket;
+            const FlatHashSet* secondary_bucket;
+            uint64_t h;
+            uint64_t secondary_h;
+        };
+        collectPipelinedMatchIndicesInto<Probe>(result, substrings.size(), workers, batch,
+            [&](size_t i, Probe& probe, SearchStats& stats) {
+                const std::string_view substring = substrings[i];
+                stats.probes++;
+                probe.bucket = primary.find(substring.length());
+                if (!probe.bucket) return;
+                probe.secondary_bucket =
+                    mode == MatchMode::DoubleHash ? secondary.find(substring.length()) : nullptr;
+                double false_positive = static_cast<double>(probe.bucket->size()) /
+                                        static_cast<double>(hasher.getModulus());
+                if (probe.secondary_bucket) {
+                    false_positive *= static_cast<double>(probe.secondary_bucket->size()) /
+                                      static_cast<double>(secondary_hasher.getModulus());
+                }
+                stats.estimated_false_positive_rate += false_positive;
+
+                probe.h = hasher.hash(substring);
+                if (!passesBloom(substring, probe.h, stats)) {
+                    probe.bucket = nullptr;
+                    return;
+                }
+                probe.bucket->prefetch(probe.h);
+                if (probe.secondary_bucket) {
+                    probe.secondary_h = secondary_hasher.hash(substring);
+                    probe.secondary_bucket->prefetch(probe.secondary_h);
+                }
+            },
+            [&](size_t, const Probe& probe, SearchStats& stats) {
+                if (!probe.bucket) return false;
+                if (!probe.bucket->contains(probe.h)) {
+                    if (bloom) stats.bloom_false_positives++;
+                    return false;
+                }
+                if (probe.secondary_bucket && !probe.secondary_bucket->contains(probe.secondary_h)) return false;
+                stats.hash_hits++;
+                return true;
+            });
+
+        last_stats.estimated_false_positive_rate /= static_cast<double>(last_stats.probes);
+    }
+
+    // Number of workers for `units` of work, keeping at least min_per_thread units each
+    size_t workersFor(size_t units, size_t min_per_thread) const {
+        size_t workers = std::min(configuredThreads(), units / std::max<size_t>(min_per_thread, 1));
+        return std::max<size_t>(workers, 1);
+    }
+
+    // Evaluate matches(i, stats) for i in [0, count) over contiguous ranges, one per worker
+    // Each worker fills its own result buffer and stats; buffers are concatenated in worker
+    // order so the matching indices come out ascending, in the input order of the patterns.
+    template<typename Matches>
+    std::vector<size_t> collectMatchIndices(size_t count, size_t workers, Matches&& matches) {
+        std::vector<size_t> result;
+        collectMatchIndicesInto(result, count, workers, std::forward<Matches>(matches));
+        return result;
+    }
+
+    // collectMatchIndices into result, replacing its contents
+    // A single worker appends straight to result, so a reused result buffer does not allocate.
+    template<typename Matches>
+    void collectMatchIndicesInto(std::vector<size_t>& result, size_t count, size_t workers,
+                                 Matches&& matches) {
+        collectRangeMatchesInto(result, count, workers,
+                                [&](size_t first, size_t last, std::vector<size_t>& out, SearchStats& stats) {
+                                    for (size_t i = first; i < last; i++) {
+                                        if (matches(i, stats)) out.push_back(i);
+                                    }
+                                });
+    }
+
+    // collectMatchIndicesInto in two passes over groups of `batch` indices: prepare(i, state,
+    // stats) runs for the whole group first, hashing and issuing prefetches, then
+    // resolve(i, state, stats) decides each match once the memory it reads is on its way.
+    // Each worker keeps one State per index of its current group.
+    template<typename State, typename Prepare, typename Resolve>
+    void collectPipelinedMatchIndicesInto(std::vector<size_t>& result, size_t count, size_t workers,
+                                          size_t batch, Prepare&& prepare, Resolve&& resolve) {
+        batch = std::min(std::max<size_t>(batch, 1), PROBE_BATCH);
+        collectRangeMatchesInto(result, count, workers,
+                                [&](size_t first, size_t last, std::vector<size_t>& out, SearchStats& stats) {
+                                    std::array<State, PROBE_BATCH> states;
+                                    for (size_t group = first; group < last; group += batch) {
+                                        const size_t end = std::min(group + batch, last);
+                                        for (size_t i = group; i < end; i++) prepare(i, states[i - group], stats);
+                                        for (size_t i = group; i < end; i++) {
+                                            if (resolve(i, states[i - group], stats)) out.push_back(i);
+                                        }
+                                    }
+                                });
+    }
+
+    // Shared driver of the two above: scan(first, last, out, stats) appends the matches
+    // among [first, last) in ascending order
+    template<typename Scan>
+    void collectRangeMatchesInto(std::vector<size_t>& result, size_t count, size_t workers, Scan&& scan) {
+        result.clear();
+        if (workers == 1) {
+            SearchStats stats;
+            scan(size_t{0}, count, result, stats);
+            accumulateStats(stats);
+            return;
+        }
+
+        std::vector<std::vector<size_t>> buffers(workers);
+        std::vector<SearchStats> worker_stats(workers);
+        parallelFor(workers, [&](size_t w) {
+            scan(count * w / workers, count * (w + 1) / workers, buffers[w], worker_stats[w]);
+        });
+
+        size_t total = 0;
+        for (const auto& buffer : buffers) total += buffer.size();
+        result.reserve(total);
+        for (size_t w = 0; w < workers; w++) {
+            result.insert(result.end(), buffers[w].begin(), buffers[w].end());
+            accumulateStats(worker_stats[w]);
+        }
+    }
+
+    void accumulateStats(const SearchStats& stats) {
+        if (metrics) metrics->add(stats);
+        last_stats.probes += stats.probes;
+        last_stats.hash_hits += stats.hash_hits;
+        last_stats.verified_collisions += stats.verified_collisions;
+        last_stats.estimated_false_positive_rate += stats.estimated_false_positive_rate;
+        last_stats.bloom_rejects += stats.bloom_rejects;
+        last_stats.bloom_false_positives += stats.bloom_false_positives;
+    }
+
+public:
+    explicit RollingHashSet(uint64_t base = RollingHasher::DEFAULT_BASE,
+                            uint64_t modulus = RollingHasher::MERSENNE_61)
+        : hasher(base, modulus), secondary_hasher(SECONDARY_BASE) {}
+
+    const SearchStats& getLastSearchStats() const { return last_stats; }
+    // Hardware counters from the most recent timeFunction call
+    const PerfCounterValues& getLastPerfCounters() const { return last_perf_counters; }
+
+    // A different byte map rehashes the persistent index over the live text
+    void setSearchConfig(const SearchConfig& config) {
+        const bool remap = config.byte_map != search_config.byte_map;
+        const bool replace_memory = config.index_memory != search_config.index_memory;
+        search_config = config;
+        if (replace_memory) applyIndexMemory();
+        if (remap) {
+            hasher.setByteMap(config.byte_map);
+            secondary_hasher.setByteMap(config.byte_map);
+            const std::string live(liveText());
+            index(live, substring_hashes.lengths());
+        }
+    }
+    const SearchConfig& getSearchConfig() const { return search_config; }
+    // Strategy that the most recent search() call dispatched to
+    SearchStrategy getLastStrategy() const { return last_strategy; }
+    const RollingHasher& getHasher() const { return hasher; }
+
+    // Where searches report counters and latencies; nullptr turns reporting off
+    void setMetrics(SearchMetrics* sink) { metrics = sink; }
+    SearchMetrics* getMetrics() const { return metrics; }
+
+    // Snapshot of metrics with this set's persistent index gauges filled in
+    MetricsSnapshot metricsSnapshot() const {
+        MetricsSnapshot snapshot = metrics ? metrics->snapshot() : MetricsSnapshot{};
+        const size_t entries = substring_hashes.size() + secondary_substring_hashes.size() +
+                               verified_substring_index.size();
+        const size_t capacity = substring_hashes.capacity() + secondary_substring_hashes.capacity() +
+                                verified_substring_index.capacity();
+        snapshot.index_entries = entries;
+        snapshot.index_bytes = substring_hashes.memoryBytes() + secondary_substring_hashes.memoryBytes() +
+                               verified_substring_index.memoryBytes();
+        for (const IndexReplica& replica : replicas) {
+            snapshot.index_bytes += replica.primary.memoryBytes() + replica.secondary.memoryBytes() +
+                                    replica.verified.memoryBytes();
+        }
+        snapshot.index_load_factor = capacity ? static_cast<double>(entries) / capacity : 0.0;
+        return snapshot;
+    }
+
+    template<typename Patterns>
+    InputShape describeInput(std::string_view main_str, const Patterns& substrings) {
+        InputShape shape;
+        shape.text_length = main_str.length();
+        shape.pattern_count = substrings.size();
+        for (const auto& substr : substrings) shape.total_pattern_bytes += substr.length();
+        std::vector<size_t> lengths = findPatternLengths(substrings);
+        shape.distinct_lengths = lengths.size();
+        for (size_t len : lengths) {
+            if (len <= main_str.length()) shape.hashed_windows += main_str.length() - len + 1;
+        }
+        return shape;
+    }
+
+    // Cheapest strategy for shape under the configured cost model
+    SearchStrategy chooseStrategy(const InputShape& shape) const {
+        if (search_config.strategy != SearchStrategy::Auto) return search_config.strategy;
+        SearchStrategy best = SearchStrategy::BruteForce;
+        double best_cost = search_config.costs.estimate(best, shape);
+        for (SearchStrategy candidate : {SearchStrategy::RollingHash, SearchStrategy::ReverseHash,
+                                         SearchStrategy::AhoCorasick, SearchStrategy::FmIndex}) {
+            double cost = search_config.costs.estimate(candidate, shape);
+            if (cost < best_cost) {
+                best = candidate;
+                best_cost = cost;
+            }
+        }
+        return best;
+    }
+
+    // Search with whichever strategy the input shape favours
+    std::vector<size_t> searchIndices(std::string_view main_str, const PatternViews& substrings) {
+        QueryScope scope(*this);
+        last_strategy = chooseStrategy(describeInput(main_str, substrings));
+        switch (last_strategy) {
+            case SearchStrategy::RollingHash:
+                return rollingHashSearchIndices(main_str, substrings, search_config.match_mode);
+            case SearchStrategy::ReverseHash:
+                return reverseHashSearchIndices(main_str, substrings, search_config.match_mode);
+            case SearchStrategy::AhoCorasick:
+                return ahoCorasickSearchIndices(main_str, substrings);
+            case SearchStrategy::FmIndex:
+                return fmIndexSearchIndices(main_str, substrings);
+            case SearchStrategy::BruteForce:
+            case SearchStrategy::Auto:
+                break;
+        }
+        return bruteForceSearchIndices(main_str, substrings);
+    }
+
+    std::vector<std::string> search(const std::string& main_str,
+                                    const std::vector<std::string>& substrings) {
+        return selectPatterns(substrings, searchIndices(main_str, toPatternViews(substrings)));
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Search a file in place through a read-only memory map; no copy of the file is made
+    std::vector<size_t> searchFile(const std::string& path, const PatternViews& substrings) {
+        MappedFile file(path);
+        return searchIndices(file.view(), substrings);
+    }
+#endif
+
+    // Refit the cost model from the fastest of `iterations` runs of each strategy on this input
+    StrategyCostModel calibrateStrategyCosts(const std::string& main_str,
+                                             const std::vector<std::string>& substrings,
+                                             int iterations = 10) {
+        StrategyCostModel model = search_config.costs;
+        InputShape shape = describeInput(main_str, substrings);
+        if (shape.text_length == 0 || shape.pattern_count == 0) return model;
+
+        auto fastest = [iterations](auto&& run) {
+            double best = 0.0;
+            for (int i = 0; i < std::max(iterations, 1); i++) {
+                auto start = std::chrono::steady_clock::now();
+                run();
+                double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start).count();
+                if (i == 0 || ns < best) best = ns;
+            }
+            return best;
+        };
+
+        double brute_ns = fastest([&] { bruteForceSearch(main_str, substrings); });
+        double rolling_ns = fastest([&] { rollingHashSearch(main_str, substrings); });
+        double reverse_ns = fastest([&] { reverseHashSearch(main_str, substrings); });
+        double build_ns = fastest([&] { AhoCorasickAutomaton automaton(substrings, search_config.byte_map); });
+        AhoCorasickAutomaton automaton(substrings, search_config.byte_map);
+        double scan_ns = fastest([&] { automaton.findPresent(main_str.data(), main_str.length()); });
+        double fm_build_ns = fastest([&] { FmIndex fm(main_str, FmIndex::Layout::Dense, search_config.byte_map); });
+        FmIndex fm(main_str, FmIndex::Layout::Dense, search_config.byte_map);
+        double fm_query_ns = fastest([&] {
+            for (const auto& substr : substrings) doNotOptimize(fm.contains(substr));
+        });
+
+        model.brute_force_ns_per_text_byte_per_pattern =
+            brute_ns / (static_cast<double>(shape.text_length) * shape.pattern_count);
+        if (shape.hashed_windows > 0) {
+            double probe_ns = model.rolling_hash_ns_per_pattern * shape.pattern_count;
+            model.rolling_hash_ns_per_window =
+                std::max(rolling_ns - probe_ns, rolling_ns * 0.5) / shape.hashed_windows;
+            double table_ns = model.reverse_hash_ns_per_pattern * shape.pattern_count;
+            model.reverse_hash_ns_per_window =
+                std::max(reverse_ns - table_ns, reverse_ns * 0.5) / shape.hashed_windows;
+        }
+        if (shape.total_pattern_bytes > 0) {
+            model.aho_corasick_ns_per_pattern_byte = build_ns / shape.total_pattern_bytes;
+        }
+        model.aho_corasick_ns_per_text_byte = scan_ns / shape.text_length;
+        model.fm_index_ns_per_text_byte = fm_build_ns / shape.text_length;
+        if (shape.total_pattern_bytes > 0) {
+            model.fm_index_ns_per_pattern_byte = fm_query_ns / shape.total_pattern_bytes;
+        }
+        return model;
+    }
+
+    // Brute force search function
+    // Patterns are independent, so large searches are split across workers; each one is
+    // located with the SIMD first/last byte filter in simd_find.
+    std::vector<size_t> bruteForceSearchIndices(std::string_view main_str, const PatternViews& substrings) {
+        QueryScope scope(*this);
+        const size_t scan_bytes = main_str.length() * substrings.size();
+        const size_t workers = std::min(workersFor(scan_bytes, search_config.min_brute_force_bytes_per_thread),
+                                        std::max<size_t>(substrings.size(), 1));
+        
+        return collectMatchIndices(substrings.size(), workers, [&](size_t i, SearchStats&) {
+            return simd_find::find(main_str, substrings[i], search_config.byte_map) != std::string_view::npos;
+        });
+    }
+
+    std::vector<std::string> bruteForceSearch(const std::string& main_str, 
+                                              const std::vector<std::string>& substrings) {
+        return selectPatterns(substrings, bruteForceSearchIndices(main_str, toPatternViews(substrings)));
+    }
+    
+    // Reverse rolling hash search function
+    // Hashes the patterns instead of the text: one small table per pattern length, then one
+    // roll over main_str per length, probing the table with every window. Memory is O(m)
+    // instead of the O(n * |lengths|) text index, and a length stops rolling as soon as all
+    // of its patterns are found. Fast mode trusts hash hits; Verified and DoubleHash both
+    // confirm them with memcmp, which is cheap here because the window is at hand.
+    std::vector<size_t> reverseHashSearchIndices(std::string_view main_str, const PatternViews& substrings,
+                                                 MatchMode mode = MatchMode::Fast) {
+        QueryScope scope(*this, true);
+        static constexpr size_t SEGMENT_WINDOWS = 1 << 16;   // early-exit granularity
+
+        last_stats = SearchStats{};
+        last_stats.mode = mode;
+        std::vector<char> found(substrings.size(), 0);
+        PatternHashTable table(substrings, hasher);
+        for (size_t id : table.emptyPatterns()) found[id] = 1;
+
+        const bool verify = mode != MatchMode::Fast;
+        const ByteMap& byte_map = search_config.byte_map;
+        const auto& slots = table.lengthSlots();
+        const char* data = main_str.data();
+        const size_t n = main_str.length();
+        double false_positive_sum = 0.0;
+        for (size_t slot = 0; slot < slots.size(); slot++) {
+            const size_t L = slots[slot].length;
+            if (L > n) continue;
+            const size_t windows = n - L + 1;
+            size_t remaining = slots[slot].pattern_count;
+            const auto& groups = slots[slot].groups;
+            const bool prefetch =
+                search_config.prefetch_probes && groups.memoryBytes() >= PREFETCH_MIN_TABLE_BYTES;
+            for (size_t start = 0; start < windows && remaining > 0; start += SEGMENT_WINDOWS) {
+                const size_t count = std::min(SEGMENT_WINDOWS, windows - start);
+                last_stats.probes += count;
+                auto resolve = [&](size_t offset, uint64_t h) {
+                    const std::vector<size_t>* candidates = table.candidates(slot, h);
+                    if (!candidates) return;
+                    last_stats.hash_hits++;
+                    for (size_t id : *candidates) {
+                        if (found[id]) continue;
+                        if (verify && !byte_map.equal(data + start + offset, substrings[id].data(), L)) {
+                            last_stats.verified_collisions++;
+                            continue;
+                        }
+                        found[id] = 1;
+                        remaining--;
+                    }
+                };
+                if (!prefetch) {
+                    forEachWindowHash(hasher, data + start, count + L - 1, L, resolve);
+                    continue;
+                }
+                // Window hashes are queued with their slots prefetched and resolved in order
+                std::array<std::pair<size_t, uint64_t>, PROBE_BATCH> queued;
+                size_t pending = 0;
+                forEachWindowHash(hasher, data + start, count + L - 1, L, [&](size_t offset, uint64_t h) {
+                    groups.prefetch(h);
+                    queued[pending++] = {offset, h};
+                    if (pending < PROBE_BATCH) return;
+                    for (const auto& [queued_offset, queued_h] : queued) resolve(queued_offset, queued_h);
+                    pending = 0;
+                });
+                for (size_t q = 0; q < pending; q++) resolve(queued[q].first, queued[q].second);
+            }
+            // An absent pattern of this length survives `windows` independent hash comparisons
+            if (!verify) {
+                false_positive_sum += slots[slot].pattern_count * static_cast<double>(windows) /
+                                      static_cast<double>(hasher.getModulus());
+            }
+        }
+        if (!substrings.empty()) {
+            last_stats.estimated_false_positive_rate = false_positive_sum / static_cast<double>(substrings.size());
+        }
+
+        std::vector<size_t> result;
+        for (size_t i = 0; i < substrings.size(); i++) {
+            if (found[i]) result.push_back(i);
+        }
+        return result;
+    }
+
+    std::vector<std::string> reverseHashSearch(const std::string& main_str,
+                                               const std::vector<std::string>& substrings,
+                                               MatchMode mode = MatchMode::Fast) {
+        return selectPatterns(substrings, reverseHashSearchIndices(main_str, toPatternViews(substrings), mode));
+    }
+
+    // Aho-Corasick search function
+    // Builds the automaton from substrings and scans main_str once, independent of the
+    // number of patterns.
+    std::vector<size_t> ahoCorasickSearchIndices(std::string_view main_str, const PatternViews& substrings) {
+        QueryScope scope(*this);
+        AhoCorasickAutomaton automaton(substrings, search_config.byte_map);
+        std::vector<bool> found = automaton.findPresent(main_str.data(), main_str.length());
+        
+        std::vector<size_t> result;
+        for (size_t i = 0; i < substrings.size(); i++) {
+            if (found[i]) result.push_back(i);
+        }
+        
+        return result;
+    }
+
+    std::vector<std::string> ahoCorasickSearch(const std::string& main_str,
+                                               const std::vector<std::string>& substrings) {
+        return selectPatterns(substrings, ahoCorasickSearchIndices(main_str, toPatternViews(substrings)));
+    }
+
+    // FM-index search function
+    // Builds a dense FmIndex over main_str in O(n) and answers each pattern in O(|p|),
+    // whatever the number of distinct lengths. For a corpus searched many times, build
+    // the FmIndex once and use queryIndices(const FmIndex&, ...).
+    std::vector<size_t> fmIndexSearchIndices(std::string_view main_str, const PatternViews& substrings) {
+        QueryScope scope(*this);
+        const FmIndex fm(main_str, FmIndex::Layout::Dense, search_config.byte_map);
+        return queryIndices(fm, substrings);
+    }
+
+    std::vector<std::string> fmIndexSearch(const std::string& main_str, const std::vector<std::string>& substrings) {
+        return selectPatterns(substrings, fmIndexSearchIndices(main_str, toPatternViews(substrings)));
+    }
+    
+    // Every occurrence of every pattern, in one pass over main_str
+    // Patterns are hashed per length; the text is walked by start offset, rolling one hash
+    // per distinct length, and each hash hit is confirmed with memcmp. Occurrences therefore
+    // come out in text order and max_matches can stop the scan early. Empty patterns have
+    // no occurrences here.
+    OccurrenceResult findOccurrences(std::string_view main_str, const PatternViews& substrings,
+                                     const OccurrenceOptions& options = {}) {
+        QueryScope scope(*this, true);
+        last_stats = SearchStats{};
+        last_stats.mode = MatchMode::Verified;
+        OccurrenceResult result;
+        result.counts.assign(substrings.size(), 0);
+        if (options.max_matches == 0) {
+            result.truncated = true;
+            return result;
+        }
+
+        PatternHashTable table(substrings, hasher);
+        const auto& slots = table.lengthSlots();
+        const char* data = main_str.data();
+        const size_t n = main_str.length();
+        std::vector<uint64_t> rolling(slots.size(), 0);
+        for (size_t slot = 0; slot < slots.size() && slots[slot].length <= n; slot++) {
+            rolling[slot] = hasher.hash(data, slots[slot].length);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            for (size_t slot = 0; slot < slots.size(); slot++) {
+                const size_t L = slots[slot].length;
+                if (i + L > n) break;   // slots are in ascending length order
+                if (i > 0) rolling[slot] = hasher.roll(rolling[slot], data[i - 1], data[i + L - 1],
+                                                       slots[slot].out_power);
+                last_stats.probes++;
+                const std::vector<size_t>* candidates = table.candidates(slot, rolling[slot]);
+                if (!candidates) continue;
+                last_stats.hash_hits++;
+                for (size_t id : *candidates) {
+                    if (!search_config.byte_map.equal(data + i, substrings[id].data(), L)) {
+                        last_stats.verified_collisions++;
+                        continue;
+                    }
+                    result.counts[id]++;
+                    result.total++;
+                    if (!options.count_only) result.occurrences.push_back(Occurrence{id, i});
+                    if (result.total == options.max_matches) {
+                        result.truncated = true;
+                        return result;
+                    }
+                }
+            }
+        }
+        return result;
+    }
+
+    OccurrenceResult findOccurrences(const std::string& main_str, const std::vector<std::string>& substrings,
+                                     const OccurrenceOptions& options = {}) {
+        return findOccurrences(std::string_view(main_str), toPatternViews(substrings), options);
+    }
+
+    // Streaming searcher for input that arrives in chunks, using this set's hash parameters
+    StreamingSearcher createStreamingSearcher(const std::vector<std::string>& substrings,
+                                              StreamingSearcher::MatchCallback on_match = {}) const {
+        return StreamingSearcher(substrings, std::move(on_match), hasher);
+    }
+
+    // Pattern set hashed once with this set's hash parameters, for batches of records
+    CompiledPatternSet compilePatterns(const std::vector<std::string>& substrings) const {
+        return CompiledPatternSet(substrings, hasher, search_config.costs);
+    }
+    
+    // Create substring hashes
+    // Each requested window length is hashed once at offset 0 and then rolled in O(1) per
+    // step, so the cost is O(n * |lengths|) with no temporary strings.
+    SubstringHashIndex createSubstringHashes(std::string_view main_str,
+                                             const std::vector<size_t>& lengths) {
+        SubstringHashIndex index;
+        extendSubstringHashes(index, main_str, lengths, hasher);
+        return index;
+    }
+
+    // Every length from 1 to max_len
+    SubstringHashIndex createSubstringHashes(std::string_view main_str, int max_len) {
+        std::vector<size_t> lengths;
+        for (int k = 1; k <= max_len; k++) lengths.push_back(static_cast<size_t>(k));
+        return createSubstringHashes(main_str, lengths);
+    }
+
+    // Add buckets for any of lengths that index does not have yet
+    void extendSubstringHashes(SubstringHashIndex& index, std::string_view main_str,
+                               const std::vector<size_t>& lengths, const RollingHasher& h) {
+        for (size_t len : lengths) {
+            if (len == 0 || len > main_str.length() || index.hasLength(len)) continue;
+            fillBucket(index.bucket(len), h, main_str, len);
+        }
+    }
+
+    // Create hash -> first window offset map per length for verified search
+    // Only one window per hash is kept; another window with the same hash is either
+    // the same text or a true collision, which the search resolves by falling back to find().
+    VerifiedSubstringIndex createVerifiedSubstringIndex(std::string_view main_str,
+                                                        const std::vector<size_t>& lengths) {
+        VerifiedSubstringIndex index;
+        index.setMemoryPolicy(search_config.index_memory);
+        extendVerifiedSubstringIndex(index, main_str, lengths);
+        return index;
+    }
+
+    // Empty index and fill one bucket per length from main_str, reusing the existing buckets
+    // Buckets of lengths that are not refilled stay empty, so probing them finds nothing.
+    template<typename Index>
+    void refillIndex(Index& index, std::string_view main_str, const std::vector<size_t>& lengths,
+                     const RollingHasher& h) {
+        index.clearEntries();
+        for (size_t len : lengths) {
+            if (len == 0 || len > main_str.length()) continue;
+            fillBucket(index.bucket(len), h, main_str, len);
+        }
+    }
+
+    void extendVerifiedSubstringIndex(VerifiedSubstringIndex& index, std::string_view main_str,
+                                      const std::vector<size_t>& lengths) {
+        for (size_t len : lengths) {
+            if (len == 0 || len > main_str.length() || index.hasLength(len)) continue;
+            fillBucket(index.bucket(len), hasher, main_str, len);
+        }
+    }
+
+    // Stream offset one past the last indexed byte
+    size_t streamEnd() const { return indexed_base + indexed_text.length(); }
+
+    std::string_view liveText() const {
+        return std::string_view(indexed_text).substr(window_start - indexed_base);
+    }
 
-public:
-    // Brute force search function
-    std::vector<std::string> bruteForceSearch(const std::string& main_str, 
-                                              const std::vector<std::string>& substrings) {
-        std::vector<std::string> result;
-        
-        for (const auto& substr : substrings) {
-            if (main_str.find(substr) != std::string::npos) {
-                result.push_back(substr);
+    // Add buckets for lengths the persistent index lacks, over the live text
+    // Offsets in verified buckets are stream offsets. In sliding window mode the windows
+    // are counted as well, so append() can evict them later.
+    template<typename Index>
+    void extendPersistentIndex(Index& index, WindowCountIndex& counts, const std::vector<size_t>& lengths,
+                               const RollingHasher& h) {
+        const std::string_view live = liveText();
+        for (size_t len : lengths) {
+            if (len == 0 || len > live.length() || index.hasLength(len)) continue;
+            if (sliding_window == 0) {
+                fillBucket(index.bucket(len), h, live, len, window_start);
+            } else {
+                addWindows(index.bucket(len), &counts.bucket(len), h, len, window_start, streamEnd() - len + 1);
             }
         }
-        
-        return result;
     }
-    
-    // Create substring hashes
-    std::unordered_set<size_t> createSubstringHashes(const std::string& main_str, int max_len) {
-        std::unordered_set<size_t> hashes;
-        
-        for (int k = 1; k <= max_len; k++) {
-            for (int i = 0; i <= static_cast<int>(main_str.length()) - k; i++) {
-                std::string substring = main_str.substr(i, k);
-                hashes.insert(std::hash<std::string>{}(substring));
+
+    // Insert the windows of length len starting at stream offsets [first, last)
+    // With counts, the count of every window's hash goes up, and a verified bucket keeps the
+    // newest offset per hash: that window is the last of its hash to be evicted.
+    template<typename Bucket>
+    void addWindows(Bucket& bucket, FlatHashMap<uint32_t>* counts, const RollingHasher& h, size_t len,
+                    size_t first, size_t last) {
+        if (first >= last) return;
+        countWindows(last - first);
+        const char* data = indexed_text.data() + (first - indexed_base);
+        forEachWindowHash(h, data, last - first + len - 1, len, [&](size_t i, uint64_t value) {
+            const size_t offset = first + i;
+            if (counts) {
+                if (uint32_t* count = counts->find(value)) {
+                    // Already in bucket
+                    ++*count;
+                    if constexpr (Bucket::HAS_VALUE) {
+                        size_t* stored = bucket.find(value);
+                        *stored = std::max(*stored, offset);
+                    }
+                    return;
+                }
+                counts->emplace(value, 1);
             }
-        }
-        
-        return hashes;
+            if constexpr (Bucket::HAS_VALUE) bucket.emplace(value, offset);
+            else bucket.insert(value);
+        });
+    }
+
+    // Evict the windows of length len starting at stream offsets [first, last)
+    template<typename Bucket>
+    void removeWindows(Bucket& bucket, FlatHashMap<uint32_t>& counts, const RollingHasher& h, size_t len,
+                       size_t first, size_t last) {
+        if (first >= last) return;
+        countWindows(last - first);
+        const char* data = indexed_text.data() + (first - indexed_base);
+        forEachWindowHash(h, data, last - first + len - 1, len, [&](size_t, uint64_t value) {
+            uint32_t* count = counts.find(value);
+            if (!count || --*count > 0) return;
+            counts.erase(value);
+            bucket.erase(value);
+        });
+    }
+
+    size_t configuredThreads() const {
+        if (search_config.threads > 0) return search_config.threads;
+        static const size_t hardware_threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        return hardware_threads;
     }
     
     // Rolling hash search function
-    //Addtional logic
-    
-    std::vector<std::string> rollingHashSearch(const std::string& main_str, 
-                                              const std::vector<std::string>& substrings) {
+    // Fast mode trusts a single hash hit. DoubleHash requires hits in two independently
+    // seeded indexes; a true substring always hits both, so it only lowers false positives.
+    // Verified mode checks each hit with memcmp, so its result always equals bruteForceSearch.
+    std::vector<size_t> rollingHashSearchIndices(std::string_view main_str, const PatternViews& substrings,
+                                                 MatchMode mode = MatchMode::Fast) {
+        QueryScope scope(*this);
+        last_stats = SearchStats{};
+        last_stats.mode = mode;
         if (substrings.empty()) return {};
         
-        int max_len = findMaxLength(substrings);
-        auto main_str_hashes = createSubstringHashes(main_str, max_len);
+        std::vector<size_t> lengths = findPatternLengths(substrings);
+        SubstringHashIndex primary;
+        SubstringHashIndex secondary;
+        VerifiedSubstringIndex verified;
+        if (mode == MatchMode::Verified) {
+            extendVerifiedSubstringIndex(verified, main_str, lengths);
+        } else {
+            extendSubstringHashes(primary, main_str, lengths, hasher);
+        }
+        if (mode == MatchMode::DoubleHash) {
+            extendSubstringHashes(secondary, main_str, lengths, secondary_hasher);
+        }
+        BlockedBloomFilter bloom;
+        if (search_config.use_bloom_filter) {
+            bloom = mode == MatchMode::Verified ? buildBloomFilter(verified) : buildBloomFilter(primary);
+        }
         
-        std::vector<std::string> result;
-        for (const auto& substring : substrings) {
-            size_t substring_hash = std::hash<std::string>{}(substring);
-            if (main_str_hashes.find(substring_hash) != main_str_hashes.end()) {
-                result.push_back(substring);
+        return probeIndex(main_str, primary, secondary, verified, substrings, mode, &bloom);
+    }
+
+    std::vector<std::string> rollingHashSearch(const std::string& main_str, 
+                                              const std::vector<std::string>& substrings,
+                                              MatchMode mode = MatchMode::Fast) {
+        return selectPatterns(substrings, rollingHashSearchIndices(main_str, toPatternViews(substrings), mode));
+    }
+
+    // rollingHashSearchIndices using the reusable memory in context
+    // The returned reference is context.matches() and stays valid until context is used again.
+    const std::vector<size_t>& rollingHashSearchIndices(std::string_view main_str, const PatternViews& substrings,
+                                                        SearchContext& context,
+                                                        MatchMode mode = MatchMode::Fast) {
+        QueryScope scope(*this);
+        last_stats = SearchStats{};
+        last_stats.mode = mode;
+        context.result.clear();
+        if (substrings.empty()) return context.result;
+
+        findPatternLengths(substrings, context.lengths);
+        if (mode == MatchMode::Verified) {
+            refillIndex(context.verified, main_str, context.lengths, hasher);
+        } else {
+            refillIndex(context.primary, main_str, context.lengths, hasher);
+        }
+        if (mode == MatchMode::DoubleHash) {
+            refillIndex(context.secondary, main_str, context.lengths, secondary_hasher);
+        }
+        const BlockedBloomFilter* bloom = nullptr;
+        if (search_config.use_bloom_filter) {
+            if (mode == MatchMode::Verified) fillBloomFilter(context.bloom, context.verified);
+            else fillBloomFilter(context.bloom, context.primary);
+            bloom = &context.bloom;
+        }
+
+        probeIndexInto(context.result, main_str, context.primary, context.secondary, context.verified,
+                       substrings, mode, bloom);
+        return context.result;
+    }
+
+    // Build the persistent index over main_str for the given window lengths
+    // Replaces any previous index. Lengths can be left empty and supplied by query().
+    // With a sliding window set, only the last sliding_window bytes of main_str are kept.
+    void index(std::string_view main_str, const std::vector<size_t>& lengths = {}) {
+        if (sliding_window > 0 && main_str.length() > sliding_window) {
+            main_str = main_str.substr(main_str.length() - sliding_window);
+        }
+        indexed_text.assign(main_str.data(), main_str.size());
+        indexed_base = 0;
+        window_start = 0;
+        substring_hashes = SubstringHashIndex{};
+        secondary_substring_hashes = SubstringHashIndex{};
+        verified_substring_index = VerifiedSubstringIndex{};
+        substring_counts = WindowCountIndex{};
+        secondary_substring_counts = WindowCountIndex{};
+        verified_substring_counts = WindowCountIndex{};
+        substring_bloom_stale = true;
+        replicas_stale = true;
+        applyIndexMemory();
+        extendPersistentIndex(substring_hashes, substring_counts, lengths, hasher);
+    }
+
+    // Add text to the end of the persistent index
+    // Only windows that end inside the new bytes are hashed, by rolling on from the old tail.
+    // With a sliding window set, windows that start before the last sliding_window bytes are
+    // removed by rolling over the departing bytes in the same way; their counts drop and a
+    // hash leaves the index when no window with it remains.
+    void append(std::string_view text) {
+        if (text.empty()) return;
+        const size_t old_end = streamEnd();
+        indexed_text.append(text.data(), text.size());
+        const size_t new_end = streamEnd();
+        size_t new_start = window_start;
+        if (sliding_window > 0 && new_end - window_start > sliding_window) new_start = new_end - sliding_window;
+
+        // Window starts: live before [window_start, old_last), live after [new_start, new_last)
+        auto update = [&](auto& index, WindowCountIndex& counts, const RollingHasher& h) {
+            for (const size_t len : index.lengths()) {
+                const size_t old_last = old_end + 1 >= window_start + len ? old_end + 1 - len : window_start;
+                const size_t new_last = new_end + 1 >= new_start + len ? new_end + 1 - len : new_start;
+                auto& bucket = index.bucket(len);
+                FlatHashMap<uint32_t>* window_counts = sliding_window > 0 ? &counts.bucket(len) : nullptr;
+                if (window_counts) removeWindows(bucket, *window_counts, h, len, window_start, std::min(old_last, new_start));
+                addWindows(bucket, window_counts, h, len, std::max(old_last, new_start), new_last);
             }
+        };
+        update(substring_hashes, substring_counts, hasher);
+        update(secondary_substring_hashes, secondary_substring_counts, secondary_hasher);
+        update(verified_substring_index, verified_substring_counts, hasher);
+        window_start = new_start;
+        substring_bloom_stale = true;
+        replicas_stale = true;
+
+        // Drop evicted bytes once they outweigh the live ones, so trimming stays amortized O(1)
+        if (window_start - indexed_base >= std::max<size_t>(sliding_window, 4096)) {
+            indexed_text.erase(0, window_start - indexed_base);
+            indexed_base = window_start;
         }
-        
-        return result;
     }
+
+    // Keep only the last bytes of appended text indexed; 0 keeps everything
+    // The current index is rebuilt over the live text with the new window.
+    void setSlidingWindow(size_t bytes) {
+        sliding_window = bytes;
+        const std::string live(liveText());
+        std::vector<size_t> lengths = substring_hashes.lengths();
+        index(live, lengths);
+    }
+
+    size_t getSlidingWindow() const { return sliding_window; }
+
+    // Search the persistent index built by index()
+    // Lengths not indexed yet are hashed once and kept, so repeated queries only pay
+    // for hashing and probing their patterns.
+    std::vector<size_t> queryIndices(const PatternViews& substrings, MatchMode mode = MatchMode::Fast) {
+        QueryScope scope(*this);
+        last_stats = SearchStats{};
+        last_stats.mode = mode;
+        if (substrings.empty()) return {};
+
+        std::vector<size_t> lengths = findPatternLengths(substrings);
+        const size_t buckets_before = substring_hashes.bucketCount() + verified_substring_index.bucketCount();
+        const size_t secondary_buckets_before = secondary_substring_hashes.bucketCount();
+        if (mode == MatchMode::Verified) {
+            extendPersistentIndex(verified_substring_index, verified_substring_counts, lengths, hasher);
+        } else {
+            extendPersistentIndex(substring_hashes, substring_counts, lengths, hasher);
+        }
+        if (mode == MatchMode::DoubleHash) {
+            extendPersistentIndex(secondary_substring_hashes, secondary_substring_counts, lengths, secondary_hasher);
+        }
+
+        // The filter covers whichever index this mode probes and is rebuilt when it grows
+        const BlockedBloomFilter* bloom = nullptr;
+        if (search_config.use_bloom_filter) {
+            const bool verified_mode = mode == MatchMode::Verified;
+            if (substring_bloom_stale || substring_bloom_verified != verified_mode ||
+                buckets_before != substring_hashes.bucketCount() + verified_substring_index.bucketCount()) {
+                substring_bloom = verified_mode ? buildBloomFilter(verified_substring_index)
+                                                : buildBloomFilter(substring_hashes);
+                substring_bloom_verified = verified_mode;
+                substring_bloom_stale = false;
+            }
+            bloom = &substring_bloom;
+        }
+
+        if (buckets_before != substring_hashes.bucketCount() + verified_substring_index.bucketCount() ||
+            secondary_buckets_before != secondary_substring_hashes.bucketCount()) {
+            replicas_stale = true;
+        }
+        if (const IndexReplica* local = localReplica()) {
+            return probeIndex(liveText(), local->primary, local->secondary, local->verified,
+                              substrings, mode, bloom, window_start);
+        }
+        return probeIndex(liveText(), substring_hashes, secondary_substring_hashes,
+                          verified_substring_index, substrings, mode, bloom, window_start);
+    }
+
+    std::vector<std::string> query(const std::vector<std::string>& substrings,
+                                   MatchMode mode = MatchMode::Fast) {
+        return selectPatterns(substrings, queryIndices(toPatternViews(substrings), mode));
+    }
+
+    // Write the persistent Fast-mode index (see index() and query()) to path
+    // The hash parameters go into the header; the indexed text is stored too unless
+    // include_text is false. The file can be served with MappedSubstringIndex, which has
+    // no byte map, so an index hashed under one is refused.
+    void saveIndex(const std::string& path, bool include_text = true) const {
+        if (!search_config.byte_map.isIdentity()) {
+            throw std::invalid_argument("saveIndex: the file format has no byte map");
+        }
+        std::vector<SerializedIndexBucket> directory;
+        uint64_t offset = sizeof(SerializedIndexHeader) + substring_hashes.bucketCount() * sizeof(SerializedIndexBucket);
+        auto align8 = [](uint64_t x) { return (x + 7) & ~uint64_t{7}; };
+        for (const auto& [length, bucket] : substring_hashes) {
+            SerializedIndexBucket entry;
+            entry.length = length;
+            entry.capacity = bucket.capacity();
+            entry.count = bucket.size();
+            entry.keys_offset = align8(offset);
+            entry.ctrl_offset = entry.keys_offset + entry.capacity * sizeof(uint64_t);
+            offset = entry.ctrl_offset + entry.capacity;
+            directory.push_back(entry);
+        }
+
+        SerializedIndexHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, SerializedIndexHeader::MAGIC, sizeof(header.magic));
+        header.version = SerializedIndexHeader::VERSION;
+        header.byte_order = SerializedIndexHeader::BYTE_ORDER_MARK;
+        header.base = hasher.getBase();
+        header.modulus = hasher.getModulus();
+        header.bucket_count = directory.size();
+        header.text_offset = include_text ? offset : 0;
+        header.text_length = include_text ? liveText().length() : 0;
+
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) throw std::runtime_error("saveIndex: cannot write " + path);
+        uint64_t written = 0;
+        auto write = [&](const void* data, uint64_t size) {
+            out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+            written += size;
+        };
+        auto padTo = [&](uint64_t target) {
+            static const char zeros[8] = {};
+            write(zeros, target - written);
+        };
+        write(&header, sizeof(header));
+        write(directory.data(), directory.size() * sizeof(SerializedIndexBucket));
+        size_t b = 0;
+        for (const auto& [length, bucket] : substring_hashes) {
+            padTo(directory[b].keys_offset);
+            write(bucket.keyData(), directory[b].capacity * sizeof(uint64_t));
+            write(bucket.controlBytes(), directory[b].capacity);
+            b++;
+        }
+        if (include_text) write(liveText().data(), liveText().length());
+        out.flush();
+        if (!out) throw std::runtime_error("saveIndex: error writing " + path);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // Fast-mode query against an index loaded with MappedSubstringIndex
+    // Patterns are hashed with the file's parameters. A length the file has no bucket for
+    // is answered from the stored text when there is one; without it that is an error.
+    std::vector<size_t> queryIndices(const MappedSubstringIndex& index, const PatternViews& substrings) {
+        QueryScope scope(*this);
+        last_stats = SearchStats{};
+        last_stats.mode = MatchMode::Fast;
+        if (!index.hasText()) {
+            for (std::string_view substring : substrings) {
+                if (!substring.empty() && !index.hasLength(substring.length())) {
+                    throw std::invalid_argument("queryIndices: length " + std::to_string(substring.length()) +
+                                                " is not in the mapped index and no text was stored");
+                }
+            }
+        }
+        const RollingHasher& h = index.getHasher();
+        const std::string_view text = index.text();
+        const size_t workers = workersFor(substrings.size(), search_config.min_probes_per_thread);
+        return collectMatchIndices(substrings.size(), workers, [&](size_t i, SearchStats& stats) {
+            const std::string_view substring = substrings[i];
+            stats.probes++;
+            if (substring.empty()) return false;   // as in query()
+            if (!index.hasLength(substring.length())) return text.find(substring) != std::string_view::npos;
+            if (!index.contains(substring.length(), h.hash(substring))) return false;
+            stats.hash_hits++;
+            return true;
+        });
+    }
+
+    std::vector<std::string> query(const MappedSubstringIndex& index, const std::vector<std::string>& substrings) {
+        return selectPatterns(substrings, queryIndices(index, toPatternViews(substrings)));
+    }
+#endif
+
+    // Query a prebuilt FmIndex; patterns of any length, compared under the index's byte map
+    // Empty patterns match, as in bruteForceSearch.
+    std::vector<size_t> queryIndices(const FmIndex& index, const PatternViews& substrings) {
+        QueryScope scope(*this);
+        last_stats = SearchStats{};
+        const size_t workers = workersFor(substrings.size(), search_config.min_probes_per_thread);
+        return collectMatchIndices(substrings.size(), workers, [&](size_t i, SearchStats& stats) {
+            stats.probes++;
+            return index.contains(substrings[i]);
+        });
+    }
+
+    std::vector<std::string> query(const FmIndex& index, const std::vector<std::string>& substrings) {
+        return selectPatterns(substrings, queryIndices(index, toPatternViews(substrings)));
+    }
+
+#ifdef ROLLING_HASHSET_HAS_SPAN
+    std::vector<size_t> searchIndices(std::string_view main_str, std::span<const std::string_view> substrings) {
+        return searchIndices(main_str, PatternViews(substrings.begin(), substrings.end()));
+    }
+
+    std::vector<size_t> bruteForceSearchIndices(std::string_view main_str,
+                                                std::span<const std::string_view> substrings) {
+        return bruteForceSearchIndices(main_str, PatternViews(substrings.begin(), substrings.end()));
+    }
+
+    std::vector<size_t> ahoCorasickSearchIndices(std::string_view main_str,
+                                                 std::span<const std::string_view> substrings) {
+        return ahoCorasickSearchIndices(main_str, PatternViews(substrings.begin(), substrings.end()));
+    }
+
+    std::vector<size_t> rollingHashSearchIndices(std::string_view main_str,
+                                                 std::span<const std::string_view> substrings,
+                                                 MatchMode mode = MatchMode::Fast) {
+        return rollingHashSearchIndices(main_str, PatternViews(substrings.begin(), substrings.end()), mode);
+    }
+#endif
+
+    // Text currently covered by the persistent index
+    std::string_view getIndexedText() const { return liveText(); }
+    const SubstringHashIndex& getSubstringHashes() const { return substring_hashes; }
     
     // Timing function
+    // Hardware counters for the same call are available from getLastPerfCounters().
     template<typename Func, typename... Args>
     std::pair<std::vector<std::string>, double> timeFunction(Func func, Args&&... args) {
-        auto start = std::chrono::high_resolution_clock::now();
+        PerfCounters& counters = PerfCounters::shared();
+        counters.start();
+        auto start = std::chrono::steady_clock::now();
         auto result = func(std::forward<Args>(args)...);
-        auto end = std::chrono::high_resolution_clock::now();
+        auto end = std::chrono::steady_clock::now();
+        last_perf_counters = counters.stop();
         
         auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
         double milliseconds = duration.count() / 1000000.0;
@@ -74,6 +4809,173 @@ public:
         return std::make_pair(result, milliseconds);
     }
     
+    // Nanoseconds per window for the scalar roll and the multi-lane kernel on text
+    std::pair<double, double> benchmarkHashKernels(std::string_view text, size_t len, int iterations = 5) {
+        if (len == 0 || len > text.length()) return {0.0, 0.0};
+        const size_t windows = text.length() - len + 1;
+        uint64_t sink = 0;
+        auto fastest = [&](auto&& run) {
+            double best = 0.0;
+            for (int i = 0; i < std::max(iterations, 1); i++) {
+                auto start = std::chrono::steady_clock::now();
+                run();
+                double ns = std::chrono::duration<double, std::nano>(
+                    std::chrono::steady_clock::now() - start).count();
+                if (i == 0 || ns < best) best = ns;
+            }
+            return best / static_cast<double>(windows);
+        };
+        double scalar = fastest([&] {
+            const uint64_t out_power = hasher.power(len - 1);
+            uint64_t value = hasher.hash(text.data(), len);
+            sink += value;
+            for (size_t i = 1; i < windows; i++) {
+                value = hasher.roll(value, text[i - 1], text[i + len - 1], out_power);
+                sink += value;
+            }
+        });
+        double lanes = fastest([&] {
+            hasher.forEachWindowHashLanes<HASH_LANES>(text.data(), text.length(), len,
+                                                      [&](size_t, uint64_t value) { sink += value; });
+        });
+        volatile uint64_t keep = sink;
+        (void)keep;
+        return {scalar, lanes};
+    }
+    
+    // Measure every strategy of sweep.strategies on each generated input of the sweep
+    // Inputs come from a WorkloadGenerator seeded with sweep.seed.
+    std::vector<BenchmarkResult> runBenchmarkSweep(const BenchmarkSweep& sweep) {
+        std::vector<BenchmarkResult> results;
+        const SearchConfig previous_config = search_config;
+        WorkloadGenerator generator(sweep.seed);
+
+        for (size_t n : sweep.text_lengths) {
+            const std::string text = generator.text(sweep.text_kind, n);
+            for (const PatternLengthRange& range : sweep.pattern_lengths) {
+                for (size_t m : sweep.pattern_counts) {
+                    const std::vector<std::string> patterns =
+                        generator.patterns(text, sweep.text_kind, m, range, sweep.hit_rate);
+                    const PatternViews views = toPatternViews(patterns);
+
+                    for (SearchStrategy strategy : sweep.strategies) {
+                        search_config.strategy = strategy;
+                        BenchmarkResult result;
+                        result.strategy = strategy;
+                        result.text_kind = sweep.text_kind;
+                        result.hit_rate = sweep.hit_rate;
+                        result.text_length = n;
+                        result.pattern_count = m;
+                        result.lengths = range;
+                        result.name = std::string(textKindName(sweep.text_kind)) + "/" +
+                                      strategyName(strategy) + "/n=" + std::to_string(n) +
+                                      "/m=" + std::to_string(m) + "/len=" + std::to_string(range.min_length) +
+                                      "-" + std::to_string(range.max_length);
+                        result.matches = searchIndices(text, views).size();
+                        result.stats = runBenchmark([&] { doNotOptimize(searchIndices(text, views)); },
+                                                    sweep.options);
+                        results.push_back(std::move(result));
+                    }
+                }
+            }
+        }
+        search_config = previous_config;
+        return results;
+    }
+
+    // Record batches for each pattern count and length range of sweep
+    // A CompiledPatternSet search over all records (reported under the reverse hash strategy,
+    // which is what it runs) is compared with one search() call per record.
+    std::vector<BenchmarkResult> runRecordBenchmark(const BenchmarkSweep& sweep) {
+        std::vector<BenchmarkResult> results;
+        WorkloadGenerator generator(sweep.seed);
+        const std::vector<std::string> records = generator.records(sweep.text_kind, sweep.record_count);
+        const PatternViews record_views = toPatternViews(records);
+        std::string joined;
+        for (const std::string& record : records) joined += record + '\n';
+
+        for (const PatternLengthRange& range : sweep.pattern_lengths) {
+            for (size_t m : sweep.pattern_counts) {
+                const std::vector<std::string> patterns =
+                    generator.patterns(joined, sweep.text_kind, m, range, sweep.hit_rate);
+                const PatternViews views = toPatternViews(patterns);
+                const CompiledPatternSet compiled = compilePatterns(patterns);
+
+                auto measure = [&](SearchStrategy strategy, const std::string& method, auto&& run, size_t matches) {
+                    BenchmarkResult result;
+                    result.strategy = strategy;
+                    result.text_kind = sweep.text_kind;
+                    result.hit_rate = sweep.hit_rate;
+                    result.text_length = joined.length() - records.size();
+                    result.records = records.size();
+                    result.pattern_count = m;
+                    result.lengths = range;
+                    result.matches = matches;
+                    result.name = std::string(textKindName(sweep.text_kind)) + "/records/" + method +
+                                  "/r=" + std::to_string(records.size()) + "/m=" + std::to_string(m) +
+                                  "/len=" + std::to_string(range.min_length) + "-" + std::to_string(range.max_length);
+                    result.stats = runBenchmark(run, sweep.options);
+                    results.push_back(std::move(result));
+                };
+
+                RecordMatches batch = compiled.search(record_views);
+                size_t batch_matches = 0;
+                for (size_t r = 0; r < records.size(); r++) batch_matches += batch.count(r);
+                measure(SearchStrategy::ReverseHash, "compiled batch",
+                        [&] { doNotOptimize(compiled.search(record_views)); }, batch_matches);
+
+                size_t per_record_matches = 0;
+                for (std::string_view record : record_views) per_record_matches += searchIndices(record, views).size();
+                measure(SearchStrategy::Auto, "per-record search", [&] {
+                    for (std::string_view record : record_views) doNotOptimize(searchIndices(record, views));
+                }, per_record_matches);
+            }
+        }
+        return results;
+    }
+
+    // Probe the persistent index of each sweep text one pattern at a time and in prefetched
+    // PROBE_BATCH groups; the index is built once per text and pattern length range, so only
+    // probing is timed. Texts of tens of MB give indexes well past the last-level cache.
+    std::vector<BenchmarkResult> runIndexProbeBenchmark(const BenchmarkSweep& sweep) {
+        std::vector<BenchmarkResult> results;
+        const SearchConfig previous_config = search_config;
+        WorkloadGenerator generator(sweep.seed);
+
+        for (size_t n : sweep.text_lengths) {
+            const std::string text = generator.text(sweep.text_kind, n);
+            for (const PatternLengthRange& range : sweep.pattern_lengths) {
+                for (size_t m : sweep.pattern_counts) {
+                    const std::vector<std::string> patterns =
+                        generator.patterns(text, sweep.text_kind, m, range, sweep.hit_rate);
+                    const PatternViews views = toPatternViews(patterns);
+                    index(text, findPatternLengths(views));
+
+                    for (bool prefetch : {false, true}) {
+                        search_config.prefetch_probes = prefetch;
+                        BenchmarkResult result;
+                        result.strategy = SearchStrategy::RollingHash;
+                        result.text_kind = sweep.text_kind;
+                        result.hit_rate = sweep.hit_rate;
+                        result.text_length = n;
+                        result.pattern_count = m;
+                        result.probes = m;
+                        result.lengths = range;
+                        result.name = std::string(textKindName(sweep.text_kind)) + "/index probes/" +
+                                      (prefetch ? "pipelined" : "one at a time") + "/n=" + std::to_string(n) +
+                                      "/m=" + std::to_string(m) + "/len=" + std::to_string(range.min_length) +
+                                      "-" + std::to_string(range.max_length);
+                        result.matches = queryIndices(views).size();
+                        result.stats = runBenchmark([&] { doNotOptimize(queryIndices(views)); }, sweep.options);
+                        results.push_back(std::move(result));
+                    }
+                }
+            }
+        }
+        search_config = previous_config;
+        return results;
+    }
+
     // Performance analysis
     void analyzePerformance(const std::string& main_str, 
                            const std::vector<std::string>& substrings, 
@@ -83,67 +4985,142 @@ public:
         std::cout << "Number of substrings to search: " << substrings.size() << std::endl;
         std::cout << "Iterations per test: " << iterations << std::endl;
         
-        // Time brute force approach
-        std::vector<double> brute_times;
-        for (int i = 0; i < iterations; i++) {
-            auto [result, exec_time] = timeFunction([this](const std::string& str, const std::vector<std::string>& subs) {
-                return this->bruteForceSearch(str, subs);
-            }, main_str, substrings);
-            brute_times.push_back(exec_time);
-        }
-        
-        // Time rolling hash approach
-        //time for the approach
-        std::vector<double> rolling_times;
-        for (int i = 0; i < iterations; i++) {
-            auto [result, exec_time] = timeFunction([this](const std::string& str, const std::vector<std::string>& subs) {
-                return this->rollingHashSearch(str, subs);
-            }, main_str, substrings);
-            rolling_times.push_back(exec_time);
-        }
-        
-        // Calculate statistics
-        double brute_avg = std::accumulate(brute_times.begin(), brute_times.end(), 0.0) / brute_times.size();
-        double rolling_avg = std::accumulate(rolling_times.begin(), rolling_times.end(), 0.0) / rolling_times.size();
-        double brute_min = *std::min_element(brute_times.begin(), brute_times.end());
-        double rolling_min = *std::min_element(rolling_times.begin(), rolling_times.end());
-        double brute_max = *std::max_element(brute_times.begin(), brute_times.end());
-        double rolling_max = *std::max_element(rolling_times.begin(), rolling_times.end());
-        
+        BenchmarkOptions options;
+        options.samples = static_cast<size_t>(std::max(iterations, 1));
+        BenchmarkStats brute = runBenchmark([&] { doNotOptimize(bruteForceSearch(main_str, substrings)); }, options);
+        BenchmarkStats rolling = runBenchmark([&] { doNotOptimize(rollingHashSearch(main_str, substrings)); }, options);
+        BenchmarkStats aho = runBenchmark([&] { doNotOptimize(ahoCorasickSearch(main_str, substrings)); }, options);
+
         std::cout << std::fixed << std::setprecision(4);
-        std::cout << "\n--- BRUTE FORCE APPROACH ---" << std::endl;
-        std::cout << "Average time: " << brute_avg << " ms" << std::endl;
-        std::cout << "Min time: " << brute_min << " ms" << std::endl;
-        std::cout << "Max time: " << brute_max << " ms" << std::endl;
-        
-        std::cout << "\n--- ROLLING HASH APPROACH ---" << std::endl;
-        std::cout << "Average time: " << rolling_avg << " ms" << std::endl;
-        std::cout << "Min time: " << rolling_min << " ms" << std::endl;
-        std::cout << "Max time: " << rolling_max << " ms" << std::endl;
+        const double bytes = static_cast<double>(main_str.length());
+        auto report = [bytes](const std::string& title, const BenchmarkStats& stats) {
+            const double ms = 1e-6;
+            std::cout << "\n--- " << title << " ---" << std::endl;
+            std::cout << "Samples: " << stats.samples << " x " << stats.runs_per_sample << " runs" << std::endl;
+            std::cout << "Median time: " << stats.median * ms << " ms (p95 " << stats.p95 * ms
+                      << ", p99 " << stats.p99 * ms << ")" << std::endl;
+            std::cout << "Mean time: " << stats.mean * ms << " ms, 95% CI [" << stats.ci95_low * ms << ", "
+                      << stats.ci95_high * ms << "], stddev " << stats.stddev * ms << std::endl;
+            std::cout << "Min/max time: " << stats.min * ms << " / " << stats.max * ms << " ms" << std::endl;
+            const PerfCounterValues& c = stats.counters;
+            if (c.has(PerfEvent::Instructions)) {
+                std::cout << "IPC: " << c.ipc() << ", L1D misses/byte: " << c.per(PerfEvent::L1dMisses, bytes)
+                          << ", LLC misses/byte: " << c.per(PerfEvent::LlcMisses, bytes)
+                          << ", branch misses: " << c.get(PerfEvent::BranchMisses) << std::endl;
+            } else if (c.has(PerfEvent::Cycles)) {
+                std::cout << (c.cycles_from_tsc ? "TSC cycles: " : "Cycles: ") << c.get(PerfEvent::Cycles)
+                          << " (hardware counters unavailable)" << std::endl;
+            }
+        };
+        report(std::string("BRUTE FORCE APPROACH (") + simd_find::kernelName() + " kernel)", brute);
+        report("ROLLING HASH APPROACH", rolling);
+        report("AHO-CORASICK APPROACH", aho);
         
-        // Performance comparison
-        if (rolling_avg < brute_avg) {
-            double speedup = brute_avg / rolling_avg;
+        // Performance comparison, by median so that outlier samples do not swing it
+        if (rolling.median < brute.median) {
+            double speedup = brute.median / rolling.median;
             std::cout << "\n🚀 Rolling hash is " << speedup << "x FASTER than brute force!" << std::endl;
         } else {
-            double slowdown = rolling_avg / brute_avg;
+            double slowdown = rolling.median / brute.median;
             std::cout << "\n⚠️ Rolling hash is " << slowdown << "x SLOWER than brute force!" << std::endl;
         }
+        if (aho.median < brute.median) {
+            std::cout << "🚀 Aho-Corasick is " << brute.median / aho.median << "x FASTER than brute force!" << std::endl;
+        } else {
+            std::cout << "⚠️ Aho-Corasick is " << aho.median / brute.median << "x SLOWER than brute force!" << std::endl;
+        }
+
+        // Hash kernel throughput on a sample of at least 1 MB built from main_str
+        if (!main_str.empty() && static_cast<size_t>(findMaxLength(substrings)) > 0) {
+            std::string sample;
+            while (sample.length() < (1 << 20)) sample += main_str;
+            auto [scalar_ns, lanes_ns] = benchmarkHashKernels(sample, static_cast<size_t>(findMaxLength(substrings)));
+            std::cout << "Hash kernel: scalar " << scalar_ns << " ns/window, " << HASH_LANES << "-lane "
+                      << lanes_ns << " ns/window (" << scalar_ns / lanes_ns << "x)" << std::endl;
+        }
+
+        // Strategy selection for this input shape
+        InputShape shape = describeInput(main_str, substrings);
+        std::cout << "Auto strategy (default cost model): " << strategyName(chooseStrategy(shape)) << std::endl;
+        SearchConfig previous_config = search_config;
+        search_config.strategy = SearchStrategy::Auto;
+        search_config.costs = calibrateStrategyCosts(main_str, substrings);
+        std::cout << "Auto strategy (calibrated on this input): " << strategyName(chooseStrategy(shape)) << std::endl;
+        search_config = previous_config;
         
         // Analysis
         std::cout << "\n--- ANALYSIS ---" << std::endl;
         int max_len = findMaxLength(substrings);
-        int total_operations = 0;
-        for (int k = 1; k <= max_len; k++) {
-            total_operations += static_cast<int>(main_str.length()) - k + 1;
+        std::vector<size_t> lengths = findPatternLengths(substrings);
+        size_t all_length_operations = 0;
+        for (size_t k = 1; k <= static_cast<size_t>(max_len) && k <= main_str.length(); k++) {
+            all_length_operations += main_str.length() - k + 1;
+        }
+        size_t total_operations = 0;
+        for (size_t len : lengths) {
+            if (len <= main_str.length()) {
+                total_operations += main_str.length() - len + 1;
+            }
         }
         
-        std::cout << "Rolling hash generates " << total_operations << " substrings and hashes" << std::endl;
+        std::cout << "Distinct pattern lengths: " << lengths.size() << " (max length " << max_len << ")" << std::endl;
+        std::cout << "Rolling hash generates " << total_operations << " substrings and hashes"
+                  << " (hashing every length up to max would be " << all_length_operations << ")" << std::endl;
         std::cout << "Brute force only checks " << substrings.size() << " substrings" << std::endl;
         std::cout << "Ratio: Rolling hash does " << total_operations << "/" << substrings.size() 
                   << " = " << (double)total_operations/substrings.size() << "x more work!" << std::endl;
+
+        // The suffix-index alternative covers every length with one O(n) build
+        for (FmIndex::Layout layout : {FmIndex::Layout::Dense, FmIndex::Layout::Compressed}) {
+            auto start = std::chrono::steady_clock::now();
+            FmIndex fm(main_str, layout, search_config.byte_map);
+            const double build_ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+            std::cout << (layout == FmIndex::Layout::Dense ? "Dense" : "Compressed") << " FM-index: built in "
+                      << build_ms << " ms, " << fm.memoryBytes() << " bytes for all pattern lengths" << std::endl;
+        }
+
+        // False-positive exposure of the unverified modes
+        std::cout << std::scientific << std::setprecision(3);
+        rollingHashSearch(main_str, substrings, MatchMode::Fast);
+        std::cout << "Estimated false-positive rate (single hash): "
+                  << last_stats.estimated_false_positive_rate << " per absent pattern" << std::endl;
+        rollingHashSearch(main_str, substrings, MatchMode::DoubleHash);
+        std::cout << "Estimated false-positive rate (double hash): "
+                  << last_stats.estimated_false_positive_rate << " per absent pattern" << std::endl;
+        rollingHashSearch(main_str, substrings, MatchMode::Verified);
+        std::cout << "Verified mode collisions: " << last_stats.verified_collisions << std::endl;
+
+        // Bloom filter front-end
+        SearchConfig previous_bloom_config = search_config;
+        search_config.use_bloom_filter = true;
+        rollingHashSearch(main_str, substrings);
+        search_config = previous_bloom_config;
+        std::cout << "Bloom filter: " << last_stats.bloom_bytes << " bytes, estimated false-positive rate "
+                  << last_stats.bloom_estimated_false_positive_rate << ", rejected "
+                  << last_stats.bloom_rejects << "/" << last_stats.probes << " probes, "
+                  << last_stats.bloom_false_positives << " false positives" << std::endl;
+        std::cout << std::fixed << std::setprecision(4);
     }
     
+    // Distinct non-zero pattern lengths, ascending
+    template<typename Patterns>
+    std::vector<size_t> findPatternLengths(const Patterns& strings) {
+        std::vector<size_t> lengths;
+        findPatternLengths(strings, lengths);
+        return lengths;
+    }
+
+    template<typename Patterns>
+    void findPatternLengths(const Patterns& strings, std::vector<size_t>& lengths) {
+        lengths.clear();
+        for (const auto& str : strings) {
+            if (!str.empty()) lengths.push_back(str.length());
+        }
+        std::sort(lengths.begin(), lengths.end());
+        lengths.erase(std::unique(lengths.begin(), lengths.end()), lengths.end());
+    }
+
     // Find max length in vector of strings
     int findMaxLength(const std::vector<std::string>& strings) {
         int max_len = 0;
@@ -154,7 +5131,405 @@ public:
     }
 };
 
-int main() {
+// One immutable version of an indexed corpus, safe to probe from any number of threads
+// It holds the corpus and a verified (hash -> first offset) index per length, so answers
+// are exact: a hash hit is confirmed against the text and a collision falls back to
+// find(). Lengths that were not indexed are answered by a SIMD scan of the text.
+class IndexSnapshot {
+public:
+    IndexSnapshot(std::string text, VerifiedSubstringIndex index, const RollingHasher& hasher, uint64_t version)
+        : corpus(std::move(text)), index(std::move(index)), hasher(hasher), snapshot_version(version) {}
+
+    // Empty patterns never match, as in RollingHashSet::query()
+    bool contains(std::string_view pattern) const {
+        if (pattern.empty()) return false;
+        const ByteMap& byte_map = hasher.getByteMap();
+        const auto* bucket = index.find(pattern.length());
+        if (!bucket) return simd_find::find(corpus, pattern, byte_map) != std::string_view::npos;
+        const size_t* offset = bucket->find(hasher.hash(pattern));
+        if (!offset) return false;
+        if (byte_map.equal(corpus.data() + *offset, pattern.data(), pattern.length())) return true;
+        return simd_find::find(corpus, pattern, byte_map) != std::string_view::npos;
+    }
+
+    std::vector<size_t> queryIndices(const PatternViews& patterns) const {
+        std::vector<size_t> result;
+        for (size_t i = 0; i < patterns.size(); i++) {
+            if (contains(patterns[i])) result.push_back(i);
+        }
+        return result;
+    }
+
+    std::string_view text() const { return corpus; }
+    std::vector<size_t> lengths() const { return index.lengths(); }
+    size_t memoryBytes() const { return corpus.size() + index.memoryBytes(); }
+    uint64_t version() const { return snapshot_version; }
+
+private:
+    std::string corpus;
+    VerifiedSubstringIndex index;
+    RollingHasher hasher;
+    uint64_t snapshot_version;
+};
+
+// A corpus index shared by concurrent readers, replaced RCU-style on rebuild
+// Readers take the current snapshot with std::atomic_load and keep it alive for as long
+// as they use it; rebuild() builds the next snapshot off to the side and swaps it in, so
+// readers never wait for a build and never see a half-built index. The last reader of an
+// old snapshot frees it. Rebuilds are serialized with each other.
+class SharedSubstringIndex {
+public:
+    explicit SharedSubstringIndex(const SearchConfig& config = {})
+        : current(std::make_shared<const IndexSnapshot>(std::string(), VerifiedSubstringIndex{},
+                                                        RollingHasher(), 0)) {
+        builder.setSearchConfig(config);
+    }
+
+    void rebuild(std::string text, const std::vector<size_t>& lengths) {
+        std::lock_guard<std::mutex> lock(rebuild_mutex);
+        VerifiedSubstringIndex index = builder.createVerifiedSubstringIndex(text, lengths);
+        auto next = std::make_shared<const IndexSnapshot>(std::move(text), std::move(index),
+                                                          builder.getHasher(), ++last_version);
+        std::atomic_store(&current, std::shared_ptr<const IndexSnapshot>(std::move(next)));
+    }
+
+    std::shared_ptr<const IndexSnapshot> snapshot() const { return std::atomic_load(&current); }
+
+    std::vector<size_t> queryIndices(const PatternViews& patterns) const {
+        return snapshot()->queryIndices(patterns);
+    }
+
+    std::vector<std::string> query(const std::vector<std::string>& patterns) const {
+        return selectPatterns(patterns, queryIndices(toPatternViews(patterns)));
+    }
+
+private:
+    std::mutex rebuild_mutex;
+    RollingHashSet builder;        // guarded by rebuild_mutex
+    uint64_t last_version = 0;     // guarded by rebuild_mutex
+    std::shared_ptr<const IndexSnapshot> current;
+};
+
+// Future-based query frontend over a SharedSubstringIndex
+// submit() queues a request and returns at once. Each worker takes every queued request,
+// up to max_batch, loads the current snapshot once, and probes the union of their
+// patterns in one pass ordered by length, so a pattern asked by several concurrent
+// requests is probed once and each length's bucket is visited contiguously. All requests
+// in a batch see the same snapshot. The destructor answers whatever is still queued.
+// Each request's queue-to-answer latency and the batch's distinct probes go to metrics.
+class QueryService {
+public:
+    explicit QueryService(const SharedSubstringIndex& index, size_t threads = 1, size_t max_batch = 256,
+                          SearchMetrics* metrics = &SearchMetrics::global())
+        : index(index), max_batch(std::max<size_t>(max_batch, 1)), metrics(metrics) {
+        for (size_t t = 0; t < std::max<size_t>(threads, 1); t++) workers.emplace_back([this] { run(); });
+    }
+
+    ~QueryService() {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_ready.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    QueryService(const QueryService&) = delete;
+    QueryService& operator=(const QueryService&) = delete;
+
+    // Ids of the patterns that occur in the corpus, ascending
+    std::future<std::vector<size_t>> submit(std::vector<std::string> patterns) {
+        Request request{std::move(patterns), {}, std::chrono::steady_clock::now()};
+        std::future<std::vector<size_t>> result = request.result.get_future();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            if (stopping) throw std::runtime_error("QueryService: submit after shutdown");
+            queue.push_back(std::move(request));
+        }
+        queue_ready.notify_one();
+        return result;
+    }
+
+    size_t requestsServed() const { return requests_served.load(std::memory_order_relaxed); }
+    size_t batchesServed() const { return batches_served.load(std::memory_order_relaxed); }
+
+private:
+    struct Request {
+        std::vector<std::string> patterns;
+        std::promise<std::vector<size_t>> result;
+        std::chrono::steady_clock::time_point submitted;
+    };
+
+    // One pattern of one request; probes are sorted so equal patterns are adjacent
+    struct Probe {
+        std::string_view pattern;
+        uint32_t request;
+        uint32_t id;
+    };
+
+    const SharedSubstringIndex& index;
+    const size_t max_batch;
+    SearchMetrics* metrics;
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<Request> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> requests_served{0};
+    std::atomic<size_t> batches_served{0};
+
+    void run() {
+        std::vector<Request> batch;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_ready.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (queue.empty()) return;
+                while (!queue.empty() && batch.size() < max_batch) {
+                    batch.push_back(std::move(queue.front()));
+                    queue.pop_front();
+                }
+            }
+            requests_served.fetch_add(batch.size(), std::memory_order_relaxed);
+            batches_served.fetch_add(1, std::memory_order_relaxed);
+            serve(batch);
+            batch.clear();
+        }
+    }
+
+    void serve(std::vector<Request>& batch) {
+        try {
+            const std::shared_ptr<const IndexSnapshot> snapshot = index.snapshot();
+            std::vector<Probe> probes;
+            for (uint32_t r = 0; r < batch.size(); r++) {
+                for (uint32_t id = 0; id < batch[r].patterns.size(); id++) {
+                    probes.push_back(Probe{batch[r].patterns[id], r, id});
+                }
+            }
+            std::sort(probes.begin(), probes.end(), [](const Probe& a, const Probe& b) {
+                if (a.pattern.length() != b.pattern.length()) return a.pattern.length() < b.pattern.length();
+                return a.pattern < b.pattern;
+            });
+
+            std::vector<std::vector<size_t>> results(batch.size());
+            size_t distinct = 0;
+            for (size_t first = 0; first < probes.size(); distinct++) {
+                size_t last = first + 1;
+                while (last < probes.size() && probes[last].pattern == probes[first].pattern) last++;
+                if (snapshot->contains(probes[first].pattern)) {
+                    for (size_t i = first; i < last; i++) results[probes[i].request].push_back(probes[i].id);
+                }
+                first = last;
+            }
+            if (metrics) metrics->add(Metric::Probes, distinct);
+            for (size_t r = 0; r < batch.size(); r++) {
+                std::sort(results[r].begin(), results[r].end());
+                if (metrics) {
+                    metrics->recordQuery(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - batch[r].submitted).count()));
+                }
+                batch[r].result.set_value(std::move(results[r]));
+            }
+        } catch (...) {
+            for (Request& request : batch) {
+                try {
+                    request.result.set_exception(std::current_exception());
+                } catch (const std::future_error&) {
+                    // already answered before the failure
+                }
+            }
+        }
+    }
+};
+
+// Every operator new call is counted so main() can check that reused searches do not allocate
+static std::atomic<size_t> heap_allocations{0};
+
+void* operator new(size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+// Out of line so the compiler does not pair the inlined free() with its builtin operator new
+__attribute__((noinline)) void operator delete(void* p) noexcept { std::free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { std::free(p); }
+
+static std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= text.length()) {
+        size_t end = text.find(',', start);
+        if (end == std::string::npos) end = text.length();
+        items.push_back(text.substr(start, end - start));
+        start = end + 1;
+    }
+    return items;
+}
+
+// Size with an optional binary K, M or G suffix, e.g. "64K" or "1G"
+static size_t parseSize(const std::string& text) {
+    size_t used = 0;
+    const unsigned long long value = std::stoull(text, &used);
+    const std::string suffix = text.substr(used);
+    unsigned shift = 0;
+    if (suffix == "K" || suffix == "k") shift = 10;
+    else if (suffix == "M" || suffix == "m") shift = 20;
+    else if (suffix == "G" || suffix == "g") shift = 30;
+    else if (!suffix.empty()) throw std::invalid_argument("bad size " + text);
+    return static_cast<size_t>(value) << shift;
+}
+
+// Comma-separated list of sizes, e.g. "1K,64K,1M"
+static std::vector<size_t> parseSizeList(const std::string& text) {
+    std::vector<size_t> values;
+    for (const std::string& item : splitList(text)) values.push_back(parseSize(item));
+    return values;
+}
+
+// Comma-separated MIN-MAX length ranges, e.g. "8-8,4-32"; a single number is a fixed length
+static std::vector<PatternLengthRange> parseLengthRanges(const std::string& text) {
+    std::vector<PatternLengthRange> ranges;
+    for (const std::string& item : splitList(text)) {
+        const size_t dash = item.find('-');
+        PatternLengthRange range;
+        range.min_length = static_cast<size_t>(std::stoull(item.substr(0, dash)));
+        range.max_length = dash == std::string::npos ? range.min_length
+                                                     : static_cast<size_t>(std::stoull(item.substr(dash + 1)));
+        if (range.min_length == 0 || range.max_length < range.min_length) {
+            throw std::invalid_argument("bad pattern length range " + item);
+        }
+        ranges.push_back(range);
+    }
+    return ranges;
+}
+
+static double parseHitRate(const std::string& text) {
+    const double rate = std::stod(text);
+    if (!(rate >= 0.0 && rate <= 1.0)) throw std::invalid_argument("--hit-rate must be in [0, 1]");
+    return rate;
+}
+
+static const char* const USAGE =
+    "usage: rolling_hashset [--benchmark | --analyze] [options]\n"
+    "  (no mode)    built-in functionality test and analysis of a small example\n"
+    "  --benchmark  parameter sweep over every strategy, written as JSON or CSV\n"
+    "  --analyze    analyzePerformance on one generated workload\n"
+    "workload options (both modes):\n"
+    "  --seed N                 generator seed (default 1)\n"
+    "  --text-kind KIND         lowercase, dna, ascii, bytes, zipf or log (default lowercase)\n"
+    "  --hit-rate R             share of patterns that occur in the text (default 0.5)\n"
+    "  --pattern-lengths R,...  MIN-MAX length ranges, e.g. 8-8,4-32\n"
+    "  --metrics FILE           write search metrics in Prometheus text format when done\n"
+    "--benchmark options:\n"
+    "  --text-lengths N,...     sizes with optional K/M/G suffix (default 1K,64K,1M)\n"
+    "  --pattern-counts N,...   (default 10,100,1000)\n"
+    "  --records N              search N short records with a compiled pattern set instead of\n"
+    "                           whole texts; reports records per second\n"
+    "  --index-probes           probe a persistent index over each text, one pattern at a time\n"
+    "                           and prefetch-pipelined; reports probes per second\n"
+    "  --samples N              timed samples per case (default 30)\n"
+    "  --format json|csv        (default json)\n"
+    "  --out FILE               (default stdout)\n"
+    "--analyze options:\n"
+    "  --text-length N          (default 1M)\n"
+    "  --pattern-count N        (default 1000)\n"
+    "  --iterations N           timed samples per strategy (default 10)\n";
+
+// --benchmark and --analyze; returns the process exit code
+static int runCommand(int argc, char** argv) {
+    const std::string mode = argv[1];
+    BenchmarkSweep sweep;
+    std::string format = "json";
+    std::string out_path;
+    size_t text_length = 1 << 20;
+    size_t pattern_count = 1000;
+    PatternLengthRange analyze_lengths{8, 32};
+    int iterations = 10;
+    bool lengths_given = false;
+    std::string metrics_path;
+    try {
+        if (mode != "--benchmark" && mode != "--analyze") throw std::invalid_argument("unknown mode " + mode);
+        const bool benchmark = mode == "--benchmark";
+        for (int i = 2; i < argc; i++) {
+            const std::string arg = argv[i];
+            auto value = [&]() -> std::string {
+                if (i + 1 >= argc) throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+            if (arg == "--seed") sweep.seed = std::stoull(value());
+            else if (arg == "--text-kind") sweep.text_kind = parseTextKind(value());
+            else if (arg == "--hit-rate") sweep.hit_rate = parseHitRate(value());
+            else if (arg == "--metrics") metrics_path = value();
+            else if (arg == "--pattern-lengths") {
+                sweep.pattern_lengths = parseLengthRanges(value());
+                lengths_given = true;
+            }
+            else if (benchmark && arg == "--format") format = value();
+            else if (benchmark && arg == "--out") out_path = value();
+            else if (benchmark && arg == "--samples") sweep.options.samples = std::stoull(value());
+            else if (benchmark && arg == "--text-lengths") sweep.text_lengths = parseSizeList(value());
+            else if (benchmark && arg == "--pattern-counts") sweep.pattern_counts = parseSizeList(value());
+            else if (benchmark && arg == "--records") sweep.record_count = parseSize(value());
+            else if (benchmark && arg == "--index-probes") sweep.index_probes = true;
+            else if (!benchmark && arg == "--text-length") text_length = parseSize(value());
+            else if (!benchmark && arg == "--pattern-count") pattern_count = parseSize(value());
+            else if (!benchmark && arg == "--iterations") iterations = std::stoi(value());
+            else throw std::invalid_argument("unknown option " + arg + " for " + mode);
+        }
+        if (format != "json" && format != "csv") throw std::invalid_argument("--format must be json or csv");
+        if (!benchmark && lengths_given) {
+            if (sweep.pattern_lengths.size() != 1) throw std::invalid_argument("--analyze takes one length range");
+            analyze_lengths = sweep.pattern_lengths.front();
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "error: " << e.what() << "\n" << USAGE;
+        return 1;
+    }
+
+    RollingHashSet rhs;
+    // Written on every successful exit below
+    auto write_metrics = [&]() {
+        if (metrics_path.empty()) return true;
+        std::ofstream metrics_file(metrics_path);
+        writeMetricsPrometheus(metrics_file, rhs.metricsSnapshot());
+        if (!metrics_file) std::cerr << "error: cannot write " << metrics_path << std::endl;
+        return static_cast<bool>(metrics_file);
+    };
+    if (mode == "--analyze") {
+        WorkloadGenerator generator(sweep.seed);
+        const std::string text = generator.text(sweep.text_kind, text_length);
+        const std::vector<std::string> patterns =
+            generator.patterns(text, sweep.text_kind, pattern_count, analyze_lengths, sweep.hit_rate);
+        std::cout << "Workload: " << textKindName(sweep.text_kind) << " text, " << text_length << " bytes, "
+                  << pattern_count << " patterns of length " << analyze_lengths.min_length << "-"
+                  << analyze_lengths.max_length << ", hit rate " << sweep.hit_rate << ", seed " << sweep.seed
+                  << std::endl;
+        rhs.analyzePerformance(text, patterns, iterations);
+        return write_metrics() ? 0 : 1;
+    }
+
+    std::vector<BenchmarkResult> results = sweep.record_count > 0 ? rhs.runRecordBenchmark(sweep)
+                                           : sweep.index_probes   ? rhs.runIndexProbeBenchmark(sweep)
+                                                                  : rhs.runBenchmarkSweep(sweep);
+    std::ofstream file;
+    if (!out_path.empty()) {
+        file.open(out_path);
+        if (!file) {
+            std::cerr << "error: cannot write " << out_path << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& out = out_path.empty() ? std::cout : file;
+    out << std::setprecision(6);
+    if (format == "csv") writeBenchmarkCsv(out, results);
+    else writeBenchmarkJson(out, results);
+    return write_metrics() ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) return runCommand(argc, argv);
+
     RollingHashSet rhs;
     
     std::string main_str = "hellotherehowareyou";
@@ -192,13 +5567,169 @@ int main() {
     std::cout << "Rolling hash time: " << rolling_time << " ms" << std::endl;
     
     // Create substring hashes for analysis
-    int max_len = rhs.findMaxLength(substrings);
-    auto substring_hashes = rhs.createSubstringHashes(main_str, max_len);
-    std::cout << "Created " << substring_hashes.size() << " unique substring hashes" << std::endl;
+    auto substring_hashes = rhs.createSubstringHashes(main_str, rhs.findPatternLengths(substrings));
+    std::cout << "Created " << substring_hashes.size() << " unique substring hashes in "
+              << substring_hashes.bucketCount() << " length buckets" << std::endl;
     
     // Verify both methods give same result
     std::cout << "Both methods match: " << (brute_result == rolling_result ? "true" : "false") << std::endl;
+
+    // Reverse mode hashes the patterns and rolls over main_str once
+    auto reverse_result = rhs.reverseHashSearch(main_str, substrings);
+    std::cout << "Reverse hash matches brute force: "
+              << (brute_result == reverse_result ? "true" : "false") << std::endl;
+
+    // Aho-Corasick scans main_str once for all patterns
+    auto aho_result = rhs.ahoCorasickSearch(main_str, substrings);
+    std::cout << "Aho-Corasick matches brute force: "
+              << (brute_result == aho_result ? "true" : "false") << std::endl;
+
+    // FM-index answers every pattern length from one suffix index, dense or compressed
+    auto fm_result = rhs.fmIndexSearch(main_str, substrings);
+    FmIndex compressed_fm(main_str, FmIndex::Layout::Compressed);
+    std::cout << "FM-index matches brute force: "
+              << (brute_result == fm_result && rhs.query(compressed_fm, substrings) == brute_result &&
+                  compressed_fm.count("e") == SuffixArray(main_str).count("e") ? "true" : "false")
+              << std::endl;
+
+    // search() picks the strategy from the input shape
+    auto auto_result = rhs.search(main_str, substrings);
+    std::cout << "Auto search (" << strategyName(rhs.getLastStrategy()) << ") matches brute force: "
+              << (brute_result == auto_result ? "true" : "false") << std::endl;
+
+    // Streaming search over small chunks gives the same answer as searching the whole string
+    auto streaming = rhs.createStreamingSearcher(substrings);
+    for (size_t offset = 0; offset < main_str.length(); offset += 4) {
+        streaming.feed(main_str.substr(offset, 4));
+    }
+    std::cout << "Streaming search matches brute force: "
+              << (brute_result == streaming.foundPatterns() ? "true" : "false") << std::endl;
+
+    // A compiled pattern set marks which patterns occur in each record of a batch
+    const std::vector<std::string> records = {main_str.substr(0, 12), main_str.substr(8), "", "hello"};
+    const CompiledPatternSet compiled = rhs.compilePatterns(substrings);
+    const RecordMatches record_matches = compiled.search(records, 2);
+    bool compiled_matches = true;
+    for (size_t r = 0; r < records.size(); r++) {
+        compiled_matches &= rhs.bruteForceSearch(records[r], substrings) ==
+                            selectPatterns(substrings, record_matches.matches(r));
+    }
+    std::cout << "Compiled pattern set matches brute force: " << (compiled_matches ? "true" : "false")
+              << std::endl;
+
+    // A pattern set fixed at compile time needs no index build and gives the same answer
+    static constexpr char GET[] = "GET", POST[] = "POST", HEAD[] = "HEAD", HTTP_1_1[] = "HTTP/1.1";
+    using HttpKeywords = StaticPatternSet<GET, POST, HEAD, HTTP_1_1>;
+    const std::string request = "POST /upload HTTP/1.1";
+    std::cout << "Static pattern set matches rolling hash search: "
+              << (HttpKeywords::rollingHashSearch(request) ==
+                  rhs.rollingHashSearch(request, HttpKeywords::patterns(), MatchMode::Verified) ? "true" : "false")
+              << std::endl;
+
+    // A byte map folds case inside the hash and compare loops; nothing is lowercased first
+    {
+        RollingHashSet folded;
+        SearchConfig folded_config;
+        folded_config.byte_map = ByteMap::asciiCaseFold();
+        folded.setSearchConfig(folded_config);
+        const std::vector<std::string> shouted = {"HELLO", "There", "xyz"};
+        const std::vector<std::string> expected = {"HELLO", "There"};
+        const bool case_matches = folded.bruteForceSearch(main_str, shouted) == expected &&
+                                  folded.reverseHashSearch(main_str, shouted, MatchMode::Verified) == expected &&
+                                  folded.ahoCorasickSearch(main_str, shouted) == expected;
+        std::cout << "Case-insensitive search finds [HELLO, There]: " << (case_matches ? "true" : "false")
+                  << std::endl;
+    }
+
+    // Concurrent queries against a shared snapshot, answered through futures
+    {
+        SharedSubstringIndex shared;
+        shared.rebuild(main_str, rhs.findPatternLengths(substrings));
+        QueryService service(shared, 2);
+        std::vector<std::future<std::vector<size_t>>> pending;
+        for (int i = 0; i < 4; i++) pending.push_back(service.submit(substrings));
+        bool service_matches = true;
+        for (auto& result : pending) service_matches &= selectPatterns(substrings, result.get()) == brute_result;
+        std::cout << "Query service matches brute force: " << (service_matches ? "true" : "false") << std::endl;
+    }
+
+    // Every occurrence with its offset, from a single pass
+    auto occurrences = rhs.findOccurrences(main_str, substrings);
+    std::cout << "Occurrences: [";
+    for (size_t i = 0; i < occurrences.occurrences.size(); i++) {
+        const Occurrence& occ = occurrences.occurrences[i];
+        std::cout << "\"" << substrings[occ.pattern_id] << "\"@" << occ.offset;
+        if (i < occurrences.occurrences.size() - 1) std::cout << ", ";
+    }
+    std::cout << "]" << std::endl;
+
+    // Verified mode confirms every hit itself, so no brute force second pass is needed
+    auto verified_result = rhs.rollingHashSearch(main_str, substrings, MatchMode::Verified);
+    std::cout << "Verified mode matches brute force: "
+              << (brute_result == verified_result ? "true" : "false") << std::endl;
     
+    // Build the index once and serve repeated queries from it
+    rhs.index(main_str);
+    auto first_query = rhs.query({"hello", "how"});
+    auto second_query = rhs.query(substrings);
+    std::cout << "Persistent index queries match: "
+              << (first_query == std::vector<std::string>{"hello", "how"} && second_query == brute_result
+                  ? "true" : "false")
+              << " (" << rhs.getSubstringHashes().bucketCount() << " lengths indexed)" << std::endl;
+
+    // Appending continues the index instead of rebuilding it
+    RollingHashSet appended;
+    appended.index(main_str.substr(0, 7));
+    appended.query(substrings);
+    appended.append(main_str.substr(7));
+    std::cout << "Appended index matches brute force: "
+              << (appended.query(substrings) == brute_result ? "true" : "false") << std::endl;
+    appended.setSlidingWindow(9);
+    appended.append("hello");
+    std::cout << "Sliding window of 9 bytes holds \"" << appended.getIndexedText() << "\": "
+              << (appended.query(substrings) == std::vector<std::string>{"hello", "you"} ? "true" : "false")
+              << std::endl;
+
+#if defined(__unix__) || defined(__APPLE__)
+    // The persistent index survives a restart through a mapped file
+    const std::string index_path = (std::filesystem::temp_directory_path() / "rolling_hashset_demo.idx").string();
+    rhs.saveIndex(index_path);
+    {
+        MappedSubstringIndex mapped_index(index_path);
+        std::cout << "Mapped index query matches brute force: "
+                  << (rhs.query(mapped_index, substrings) == brute_result ? "true" : "false") << " ("
+                  << mapped_index.bucketCount() << " lengths loaded)" << std::endl;
+    }
+    std::filesystem::remove(index_path);
+#endif
+
+    // A reused context serves repeated searches without touching the heap
+    SearchContext context;
+    const PatternViews pattern_views = toPatternViews(substrings);
+    const std::vector<size_t> expected_indices = rhs.bruteForceSearchIndices(main_str, pattern_views);
+    bool context_matches = true;
+    for (MatchMode mode : {MatchMode::Fast, MatchMode::DoubleHash, MatchMode::Verified}) {
+        rhs.rollingHashSearchIndices(main_str, pattern_views, context, mode);   // warm-up sizes the buffers
+    }
+    const size_t allocations_before = heap_allocations.load();
+    for (int i = 0; i < 100; i++) {
+        for (MatchMode mode : {MatchMode::Fast, MatchMode::DoubleHash, MatchMode::Verified}) {
+            context_matches &= rhs.rollingHashSearchIndices(main_str, pattern_views, context, mode) ==
+                               expected_indices;
+        }
+    }
+    const size_t steady_allocations = heap_allocations.load() - allocations_before;
+    std::cout << "Reused search context matches brute force: " << (context_matches ? "true" : "false")
+              << " (" << steady_allocations << " heap allocations in 300 searches)" << std::endl;
+
+    // Every search above reported into the process-wide metrics
+    const MetricsSnapshot metrics = rhs.metricsSnapshot();
+    std::cout << "Metrics: " << metrics.get(Metric::Queries) << " queries, "
+              << metrics.get(Metric::WindowsHashed) << " windows hashed, " << metrics.get(Metric::Probes)
+              << " probes, " << metrics.get(Metric::VerifiedCollisions) << " verified collisions; latency p50 "
+              << metrics.latencyQuantileNs(0.5) / 1000.0 << " us, p99 " << metrics.latencyQuantileNs(0.99) / 1000.0
+              << " us" << std::endl;
+
     // Performance analysis
     rhs.analyzePerformance(main_str, substrings, 1000);
     